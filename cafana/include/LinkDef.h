@@ -0,0 +1,27 @@
+/**
+ * @file LinkDef.h
+ * @brief Selection of the cafana symbols for the ROOT dictionary.
+ * @details The dictionary (and its module) makes the declarations of the
+ * analysis class and the cut and variable namespaces available to the
+ * interpreter when the cafana shared library is loaded. The classes are not
+ * written to file, so no streamers are generated.
+ * @author mueller@fnal.gov
+ */
+#ifdef __CLING__
+#pragma link off all globals;
+#pragma link off all classes;
+#pragma link off all functions;
+#pragma link C++ nestedclasses;
+
+#pragma link C++ namespace cuts;
+#pragma link C++ namespace cuts::muon2024;
+#pragma link C++ namespace cuts::cosmics;
+#pragma link C++ namespace vars;
+#pragma link C++ namespace vars::muon2024;
+#pragma link C++ namespace pvars;
+#pragma link C++ namespace pcuts;
+#pragma link C++ namespace utilities;
+
+#pragma link C++ class ana::Analysis-;
+#pragma link C++ class utilities::PrimaryCounts-;
+#endif
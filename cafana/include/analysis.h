@@ -17,6 +17,23 @@
 #define ANALYSIS_H
 #include <vector>
 #include <string>
+#include <set>
+#include <map>
+#include <tuple>
+#include <memory>
+#include <fstream>
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <stdexcept>
+#include <cerrno>
+#include <ctime>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <glob.h>
 
 #include "sbnana/CAFAna/Core/SpectrumLoader.h"
 #include "sbnana/CAFAna/Core/Tree.h"
@@ -25,6 +42,12 @@
 
 #include "TDirectory.h"
 #include "TFile.h"
+#include "TFileMerger.h"
+#include "TTree.h"
+
+#include "include/utilities.h"
+#include "include/cuts.h"
+#include "include/spinetree.h"
 
 /**
  * @namespace ana
@@ -52,6 +75,38 @@ namespace ana
         bool is_sim;
     };
 
+    /**
+     * @struct ShardedSample
+     * @brief Struct to store information about a sample that is split into
+     * shards of input files.
+     * @details This struct is used to store information about a sample whose
+     * file list is split into a number of shards, each of which is run by its
+     * own SpectrumLoader and written to its own partial output file. The
+     * SpectrumLoaders are created by the Analysis class when the shard is
+     * run.
+     */
+    struct ShardedSample
+    {
+        std::string name;
+        std::vector<std::string> files;
+        bool is_sim;
+        size_t nshards;
+    };
+
+    /**
+     * @struct Unit
+     * @brief Struct to store a single unit of work (a sample or a shard of a
+     * sample) and its partial output file.
+     */
+    struct Unit
+    {
+        std::string sample;
+        ana::SpectrumLoader * loader;
+        std::vector<std::string> files;
+        bool is_sim;
+        std::string part;
+    };
+
     /**
      * @struct TreeSet
      * @brief Struct to store information about a set of variables that comprise
@@ -72,6 +127,152 @@ namespace ana
         bool is_sim;
     };
 
+    /**
+     * @class EventList
+     * @brief Compact list of the CAF entries that contain the rows of a Tree.
+     * @details The EventList records, for each row of a Tree, the CAF file
+     * and entry (in "recTree") of the spill the row came from, the run,
+     * subrun, and event of the spill, and the "nu_id" of the row. The number
+     * of entries of each file is read from the file itself, and the spills
+     * are assigned to the files in the order in which the SpectrumLoader
+     * reads them (files without entries are skipped). The assignment is
+     * checked against the "first_in_file" flag of each spill and against the
+     * total number of spills; if either check fails, the event list is not
+     * written so that downstream processing (e.g. run_systematics) falls back
+     * to reading every CAF file. Otherwise, downstream processing can open
+     * only the CAF files that contain a row and read only the listed entries.
+     */
+    class EventList
+    {
+    public:
+        /**
+         * @brief Constructor for the EventList class.
+         * @details The number of entries in "recTree" is read from each of
+         * the input files. A file that cannot be read invalidates the event
+         * list.
+         * @param files the input files of the sample, in the order in which
+         * they are read.
+         */
+        EventList(std::vector<std::string> files) : files(files)
+        {
+            for(const std::string & path : files)
+            {
+                std::unique_ptr<TFile> f(TFile::Open(path.c_str(), "READ"));
+                TTree * rec(f && !f->IsZombie() ? f->Get<TTree>("recTree") : nullptr);
+                counts.push_back(rec != nullptr ? rec->GetEntries() : -1);
+                if(rec == nullptr)
+                    Invalidate("the entries of " + path + " could not be read");
+            }
+        }
+
+        /**
+         * @brief Record the rows of a spill.
+         * @details This must be called once for every spill of the sample
+         * (whether or not it has any rows) so that the entries are counted
+         * correctly.
+         * @param sr the StandardRecord proxy of the spill.
+         * @param nu_ids the "nu_id" values of the rows of the spill.
+         * @return void
+         */
+        void Record(const caf::Proxy<caf::StandardRecord> * sr, const std::vector<double> & nu_ids)
+        {
+            ++spills;
+            if(!valid)
+                return;
+            ++entry;
+            while(size_t(file) < counts.size() && entry >= counts[file])
+            {
+                ++file;
+                entry = 0;
+            }
+            if(size_t(file) >= counts.size())
+                return Invalidate("more spills were read than the input files contain");
+            if(bool(sr->hdr.first_in_file) != (entry == 0))
+                return Invalidate("spill " + std::to_string(spills) + " does not match the first_in_file flag of entry " + std::to_string(entry) + " of " + files[file]);
+            for(double nu_id : nu_ids)
+                rows.push_back({file, entry, Int_t(sr->hdr.run), Int_t(sr->hdr.subrun), Int_t(sr->hdr.evt), Long64_t(nu_id)});
+        }
+
+        /**
+         * @brief Write the event list to a directory.
+         * @details The event list is written as a TTree with the branches
+         * "file" (the path of the CAF file), "entry", "run", "subrun",
+         * "evt", and "nu_id", with one entry per row sorted by file and
+         * entry. Nothing is written (with a warning) if the event list is
+         * invalid or if the number of spills read differs from the number of
+         * entries of the input files.
+         * @param dir the directory to write the TTree to.
+         * @param name the name of the TTree.
+         * @return void
+         */
+        void Write(TDirectory * dir, const std::string & name)
+        {
+            Long64_t total(0);
+            for(Long64_t n : counts)
+                total += n;
+            if(valid && spills != total)
+                Invalidate(std::to_string(spills) + " spills were read from input files with " + std::to_string(total) + " entries");
+            if(!valid)
+            {
+                std::cerr << "Warning: the event list " << name << " is not written: " << reason << "." << std::endl;
+                return;
+            }
+            std::stable_sort(rows.begin(), rows.end(), [](const Row & a, const Row & b) { return std::tie(a.file, a.entry) < std::tie(b.file, b.entry); });
+            std::string path;
+            Long64_t entry_, nu_id;
+            Int_t run, subrun, evt;
+            TTree tree(name.c_str(), name.c_str());
+            tree.SetDirectory(nullptr);
+            tree.Branch("file", &path);
+            tree.Branch("entry", &entry_);
+            tree.Branch("run", &run);
+            tree.Branch("subrun", &subrun);
+            tree.Branch("evt", &evt);
+            tree.Branch("nu_id", &nu_id);
+            for(const Row & r : rows)
+            {
+                path = files[r.file];
+                entry_ = r.entry;
+                run = r.run;
+                subrun = r.subrun;
+                evt = r.evt;
+                nu_id = r.nu_id;
+                tree.Fill();
+            }
+            dir->WriteTObject(&tree);
+        }
+
+    private:
+        /**
+         * @brief Mark the event list as invalid.
+         * @param why the reason, reported when the event list is written.
+         * @return void
+         */
+        void Invalidate(const std::string & why)
+        {
+            if(valid)
+                reason = why;
+            valid = false;
+            rows.clear();
+        }
+
+        struct Row
+        {
+            Long64_t file;
+            Long64_t entry;
+            Int_t run, subrun, evt;
+            Long64_t nu_id;
+        };
+        std::vector<std::string> files;
+        std::vector<Long64_t> counts;
+        Long64_t file = 0;
+        Long64_t entry = -1;
+        Long64_t spills = 0;
+        bool valid = true;
+        std::string reason;
+        std::vector<Row> rows;
+    };
+
     /**
      * @class Analysis
      * @brief Class designed to streamline the running of multiple samples
@@ -91,12 +292,27 @@ namespace ana
         public:
             Analysis(std::string name);
             void AddLoader(std::string name, ana::SpectrumLoader * loader, bool is_sim);
+            void AddShardedLoader(std::string name, std::string pattern, bool is_sim, size_t nshards);
+            void AddShardedLoader(std::string name, std::vector<std::string> files, bool is_sim, size_t nshards);
+            void SelectShards(size_t job, size_t njobs);
             void AddTree(std::string name, std::map<std::string, ana::SpillMultiVar> & vars, bool is_sim);
-            void Go();
+            template<class CUTTYPE>
+            void AddSelections(const SpineTree<CUTTYPE> & tree, bool is_sim, const std::string & prefix = "selected");
+            void AddCutFlow(cuts::CutFlowBase * flow);
+            void AddEventList(std::string tree);
+            void Go(size_t nworkers = 1);
         private:
+            void RunSample(const Sample & s, TDirectory * dir, const std::vector<std::string> & files = {});
+            void RunUnit(const Unit & u);
+            std::vector<Unit> GetUnits() const;
             std::string name;
             std::vector<Sample> samples;
+            std::vector<ShardedSample> sharded;
+            size_t job = 0;
+            size_t njobs = 1;
             std::vector<TreeSet> trees;
+            std::vector<cuts::CutFlowBase *> cutflows;
+            std::set<std::string> eventlists;
     };
 
     /**
@@ -107,7 +323,7 @@ namespace ana
      * creation of the output ROOT file.
      * @return A new instance of the Analysis class.
      */
-    Analysis::Analysis(std::string name)
+    inline Analysis::Analysis(std::string name)
     {
         this->name = name;
     }
@@ -126,11 +342,79 @@ namespace ana
      * information is available.
      * @return void
      */
-    void Analysis::AddLoader(std::string name, ana::SpectrumLoader * loader, bool is_sim)
+    inline void Analysis::AddLoader(std::string name, ana::SpectrumLoader * loader, bool is_sim)
     {
         samples.push_back({name, loader, is_sim});
     }
 
+    /**
+     * @brief Add a sample that is split into shards of input files.
+     * @details This function expands the wildcard pattern into the (sorted)
+     * list of matching files and adds the sample with
+     * @ref AddShardedLoader(std::string, std::vector<std::string>, bool, size_t).
+     * @param name The name of the sample.
+     * @param pattern The wildcard pattern matching the input files.
+     * @param is_sim A boolean indicating whether the sample is a simulation
+     * sample.
+     * @param nshards The number of shards to split the sample into.
+     * @return void
+     * @throw std::runtime_error if the pattern matches no files.
+     */
+    inline void Analysis::AddShardedLoader(std::string name, std::string pattern, bool is_sim, size_t nshards)
+    {
+        std::vector<std::string> files;
+        glob_t g;
+        if(glob(pattern.c_str(), 0, nullptr, &g) == 0)
+        {
+            for(size_t i(0); i < g.gl_pathc; ++i)
+                files.push_back(g.gl_pathv[i]);
+        }
+        globfree(&g);
+        if(files.empty())
+            throw std::runtime_error("No files match the pattern " + pattern + " for sample " + name + ".");
+        AddShardedLoader(name, files, is_sim, nshards);
+    }
+
+    /**
+     * @brief Add a sample that is split into shards of input files.
+     * @details The file list is sorted and split into (at most) "nshards"
+     * contiguous shards of nearly equal size. Each shard is run by its own
+     * SpectrumLoader and written to a partial output file, so that a failed
+     * or preempted job only needs to rerun the shards that did not complete.
+     * The shard assignment depends only on the file list and the number of
+     * shards, so it is stable across reruns.
+     * @param name The name of the sample.
+     * @param files The list of input files.
+     * @param is_sim A boolean indicating whether the sample is a simulation
+     * sample.
+     * @param nshards The number of shards to split the sample into.
+     * @return void
+     */
+    inline void Analysis::AddShardedLoader(std::string name, std::vector<std::string> files, bool is_sim, size_t nshards)
+    {
+        std::sort(files.begin(), files.end());
+        nshards = std::max<size_t>(1, std::min(nshards, files.size()));
+        sharded.push_back({name, files, is_sim, nshards});
+    }
+
+    /**
+     * @brief Select the subset of the work to be run by this job.
+     * @details This allows the samples and shards of an analysis to be spread
+     * over several jobs (e.g. grid slots) that share an output directory.
+     * Job "job" of "njobs" runs every unit of work (a sample or a shard of a
+     * sample) whose index modulo "njobs" equals "job". After running its
+     * units, each job reads the shared manifest again; the first job to find
+     * all units completed takes a lock file and merges the partial files.
+     * @param job The index of this job.
+     * @param njobs The total number of jobs.
+     * @return void
+     */
+    inline void Analysis::SelectShards(size_t job, size_t njobs)
+    {
+        this->njobs = std::max<size_t>(njobs, 1);
+        this->job = job % this->njobs;
+    }
+
     /**
      * @brief Add a Tree to the Analysis class (set of variables and names).
      * @details This function allows the user to add a new Tree to the Analysis
@@ -146,7 +430,7 @@ namespace ana
      * information is available.
      * @return void
      */
-    void Analysis::AddTree(std::string name, std::map<std::string, ana::SpillMultiVar> & vars, bool is_sim)
+    inline void Analysis::AddTree(std::string name, std::map<std::string, ana::SpillMultiVar> & vars, bool is_sim)
     {
         std::vector<std::string> n;
         std::vector<ana::SpillMultiVar> v;
@@ -159,41 +443,458 @@ namespace ana
     }
 
     /**
-     * @brief Run the analysis on the specified samples.
-     * @details This function runs the analysis on the configured samples by
-     * looping over each sample, creating the Trees for each sample, then
-     * running the analysis on the sample to populate the Trees with the
-     * results of the analysis. The results are stored in a TFile in the output
-     * ROOT file in a parent directory named "events" and a subdirectory for
-     * each sample.
+     * @brief Add a Tree for each selection of a SpineTree to the Analysis
+     * class.
+     * @details Each named selection of the SpineTree is added as a Tree named
+     * "<prefix><selection>" (e.g. "selected1muNp"). The SpineTree evaluates
+     * all of its selections in a single pass over each spill, so the
+     * selections share the interaction loop, the truth matching, and the
+     * per-interaction summaries instead of each repeating them.
+     * @tparam CUTTYPE the type of interaction the SpineTree loops over.
+     * @param tree the SpineTree holding the selections and variables.
+     * @param is_sim A boolean indicating whether the Trees represent a
+     * simulation sample, which is principally used to determine if truth
+     * information is available.
+     * @param prefix the prefix of the names of the Trees.
+     * @return void
+     */
+    template<class CUTTYPE>
+    inline void Analysis::AddSelections(const SpineTree<CUTTYPE> & tree, bool is_sim, const std::string & prefix)
+    {
+        for(const std::string & selection : tree.GetSelections())
+        {
+            std::map<std::string, ana::SpillMultiVar> vars(tree.GetVars(selection));
+            AddTree(prefix + selection, vars, is_sim);
+        }
+    }
+
+    /**
+     * @brief Add a CutFlow to the Analysis class.
+     * @details The statistics of the CutFlow are reset before each sample is
+     * run, and the cut flow histograms of the sample are written to the
+     * subdirectory of the sample alongside its Trees. The CutFlow must be
+     * used by (at least) one of the Trees of the analysis for it to be
+     * filled, and must outlive the Analysis class.
+     * @param flow the CutFlow to add.
+     * @return void
+     */
+    inline void Analysis::AddCutFlow(cuts::CutFlowBase * flow)
+    {
+        cutflows.push_back(flow);
+    }
+
+    /**
+     * @brief Write an event list for a Tree of the Analysis class.
+     * @details For each sample, the Tree named "tree" (which must have a
+     * "nu_id" variable) is accompanied by an @ref EventList named
+     * "<tree>_eventlist" in the subdirectory of the sample. The CAF files of
+     * the sample must be known, so event lists are only written for samples
+     * added with @ref AddShardedLoader() (a single shard may be used).
+     * @param tree the name of the Tree.
+     * @return void
+     */
+    inline void Analysis::AddEventList(std::string tree)
+    {
+        eventlists.insert(tree);
+    }
+
+    /**
+     * @brief Run the analysis on a single sample.
+     * @details This function creates the Trees for the sample in a
+     * subdirectory of the specified directory named after the sample, runs
+     * the SpectrumLoader of the sample to populate the Trees, and then saves
+     * the Trees (and the cut flow histograms and event lists) to the
+     * subdirectory.
+     * @param s The sample to run.
+     * @param dir The parent directory ("events") of the sample subdirectory.
+     * @param files The input files of the sample, in the order in which they
+     * are read (empty if unknown).
      * @return void
+     * @throw std::runtime_error if a Tree with an event list has no "nu_id"
+     * variable.
      */
-    void Analysis::Go()
+    inline void Analysis::RunSample(const Sample & s, TDirectory * dir, const std::vector<std::string> & files)
     {
-        TFile * f = new TFile(std::string(name + ".root").c_str(), "RECREATE");
+        TDirectory * subdir = dir->mkdir(s.name.c_str());
+        subdir->cd();
+        std::vector<ana::Tree*> sbruce_trees;
+        std::vector<std::pair<std::string, std::shared_ptr<EventList>>> lists;
+        for(const TreeSet & t : trees)
+        {
+            if(t.is_sim && !s.is_sim)
+                continue;
+
+            /**
+             * @brief Attach the event list of the Tree, if requested.
+             * @details The "nu_id" variable is wrapped so that every spill
+             * read by the SpectrumLoader is recorded in the event list.
+             */
+            std::vector<ana::SpillMultiVar> vars(t.vars);
+            if(eventlists.count(t.name) > 0 && files.empty())
+                std::cerr << "Warning: the input files of sample " << s.name << " are not known; no event list is written for " << t.name << "." << std::endl;
+            else if(eventlists.count(t.name) > 0)
+            {
+                auto it = std::find(t.names.begin(), t.names.end(), "nu_id");
+                if(it == t.names.end())
+                    throw std::runtime_error("The Tree " + t.name + " has no nu_id variable for its event list.");
+                std::shared_ptr<EventList> list(std::make_shared<EventList>(files));
+                ana::SpillMultiVar inner(vars[it - t.names.begin()]);
+                vars[it - t.names.begin()] = ana::SpillMultiVar([inner, list](const caf::Proxy<caf::StandardRecord> * sr) -> std::vector<double>
+                {
+                    std::vector<double> values(inner(sr));
+                    list->Record(sr, values);
+                    return values;
+                });
+                lists.push_back({t.name + "_eventlist", list});
+            }
+            sbruce_trees.push_back(new ana::Tree(t.name, t.names, *s.loader, vars, ana::kNoSpillCut, true));
+        }
+        for(cuts::CutFlowBase * flow : cutflows)
+            flow->Reset();
+        utilities::SpillCache::instance().invalidate();
+        s.loader->Go();
+        for(const ana::Tree * t : sbruce_trees)
+        {
+            t->SaveTo(subdir);
+            delete t;
+        }
+        for(cuts::CutFlowBase * flow : cutflows)
+            flow->Write(subdir);
+        for(auto & [n, list] : lists)
+            list->Write(subdir, n);
+        dir->cd();
+    }
+
+    /**
+     * @brief Run a single unit of work (a sample or a shard of a sample) into
+     * its partial output file.
+     * @details If the unit is a shard, its SpectrumLoader is created here
+     * from the file list of the shard.
+     * @param u The unit of work.
+     * @return void
+     * @throw std::runtime_error if the partial file cannot be written.
+     */
+    inline void Analysis::RunUnit(const Unit & u)
+    {
+        std::unique_ptr<ana::SpectrumLoader> owned;
+        ana::SpectrumLoader * loader(u.loader);
+        if(loader == nullptr)
+        {
+            owned = std::make_unique<ana::SpectrumLoader>(u.files);
+            loader = owned.get();
+        }
+        TFile * f = new TFile(u.part.c_str(), "RECREATE");
+        if(f->IsZombie())
+        {
+            delete f;
+            throw std::runtime_error("Failed to create the partial file " + u.part + ".");
+        }
         TDirectory * dir = f->mkdir("events");
         dir->cd();
+        RunSample({u.sample, loader, u.is_sim}, dir, u.files);
+        f->Close();
+        delete f;
+    }
 
+    /**
+     * @brief Get the units of work of the analysis.
+     * @details Each sample added with @ref AddLoader() is a single unit and
+     * each shard of a sample added with @ref AddShardedLoader() is a unit.
+     * The partial file of a unit is named "<name>.<sample>.part.root" or
+     * "<name>.<sample>.<shard>of<nshards>.part.root".
+     * @return the units of work, in the order the samples were added.
+     */
+    inline std::vector<Unit> Analysis::GetUnits() const
+    {
+        std::vector<Unit> units;
         for(const Sample & s : samples)
+            units.push_back({s.name, s.loader, {}, s.is_sim, name + "." + s.name + ".part.root"});
+        for(const ShardedSample & s : sharded)
+        {
+            for(size_t k(0); k < s.nshards; ++k)
+            {
+                size_t begin(k * s.files.size() / s.nshards), end((k + 1) * s.files.size() / s.nshards);
+                std::vector<std::string> files(s.files.begin() + begin, s.files.begin() + end);
+                units.push_back({s.name, nullptr, files, s.is_sim, name + "." + s.name + "." + std::to_string(k) + "of" + std::to_string(s.nshards) + ".part.root"});
+            }
+        }
+        return units;
+    }
+
+    /**
+     * @brief Run the analysis on the specified samples.
+     * @details This function runs the analysis on the configured samples,
+     * creating the Trees for each sample and then running the analysis on the
+     * sample to populate the Trees with the results of the analysis. The
+     * results are stored in a TFile in the output ROOT file in a parent
+     * directory named "events" and a subdirectory for each sample.
+     *
+     * With a single worker and no sharded samples, the samples are run one
+     * after another directly into the output ROOT file. Otherwise, each unit
+     * of work (a sample or a shard of a sample) writes its "events/<sample>"
+     * directory to its own partial file, and each completed unit is recorded
+     * in the manifest "<name>.manifest". Units that are already recorded in
+     * the manifest (and whose partial file is readable) are skipped, so a
+     * rerun after a failure or preemption processes only the missing units.
+     * Once every unit is complete, the partial files are merged (samples
+     * added with @ref AddLoader() first, then the sharded samples, with the
+     * Trees of the shards of a sample chained together) into the output ROOT
+     * file (by a single job, see @ref SelectShards()), and the partial files
+     * and manifest are removed.
+     *
+     * With more than one worker, the units are run in forked child processes
+     * (at most "nworkers" at a time). The samples are independent and read
+     * disjoint sets of files, so the wall-clock time is set by the largest
+     * unit rather than the sum of all units. Processes are used instead of
+     * threads because the SpectrumLoaders share global ROOT state (e.g.
+     * gDirectory) and are not thread-safe.
+     * @param nworkers The maximum number of units to run concurrently.
+     * @return void
+     * @throw std::runtime_error if any of the units fails.
+     */
+    inline void Analysis::Go(size_t nworkers)
+    {
+        if(nworkers <= 1 && sharded.empty() && njobs == 1)
+        {
+            TFile * f = new TFile(std::string(name + ".root").c_str(), "RECREATE");
+            TDirectory * dir = f->mkdir("events");
+            dir->cd();
+            for(const Sample & s : samples)
+                RunSample(s, dir);
+            f->Close();
+            return;
+        }
+
+        /**
+         * @brief Read the manifest of completed units.
+         * @details A unit is considered complete only if its partial file can
+         * still be opened. The manifest is shared by all jobs, so it is read
+         * again after the pending units have run to see the units completed
+         * by other jobs in the meantime.
+         */
+        const std::string manifest(name + ".manifest");
+        std::set<std::string> completed;
+        auto read_manifest = [&]()
         {
-            TDirectory * subdir = dir->mkdir(s.name.c_str());
-            subdir->cd();
-            std::vector<ana::Tree*> sbruce_trees;
-            for(const TreeSet & t : trees)
+            completed.clear();
+            std::ifstream input(manifest);
+            for(std::string line; std::getline(input, line);)
             {
-                if(t.is_sim && !s.is_sim)
+                if(completed.count(line) != 0)
                     continue;
-                sbruce_trees.push_back(new ana::Tree(t.name, t.names, *s.loader, t.vars, ana::kNoSpillCut, true));
+                TFile * f = line.empty() ? nullptr : TFile::Open(line.c_str(), "READ");
+                if(f != nullptr && !f->IsZombie())
+                    completed.insert(line);
+                delete f;
+            }
+        };
+        read_manifest();
+        auto record = [&](const Unit & u)
+        {
+            std::ofstream output(manifest, std::ios::app);
+            output << u.part << std::endl;
+            completed.insert(u.part);
+        };
+
+        std::vector<Unit> units(GetUnits());
+        std::vector<size_t> pending;
+        for(size_t i(0); i < units.size(); ++i)
+        {
+            if(i % njobs == job && completed.count(units[i].part) == 0)
+                pending.push_back(i);
+        }
+        std::cout << "Running " << pending.size() << " of " << units.size() << " units (" << completed.size() << " already complete) with " << std::max<size_t>(nworkers, 1) << " worker(s)." << std::endl;
+
+        std::vector<std::string> failed;
+        if(nworkers <= 1)
+        {
+            for(size_t i : pending)
+            {
+                RunUnit(units[i]);
+                record(units[i]);
             }
-            s.loader->Go();
-            for(const ana::Tree * t : sbruce_trees)
+        }
+        else
+        {
+            std::vector<std::pair<pid_t, size_t>> workers;
+            size_t next(0), running(0);
+            /**
+             * @brief Wait for one of the workers to finish.
+             * @details The wait is retried if it is interrupted by a signal,
+             * and children that were not forked here are ignored. If the
+             * workers can no longer be waited for (e.g. they were reaped
+             * elsewhere), the remaining workers are counted as failed.
+             */
+            auto reap = [&]()
+            {
+                while(true)
+                {
+                    int status(0);
+                    pid_t pid(waitpid(-1, &status, 0));
+                    if(pid < 0 && errno == EINTR)
+                        continue;
+                    if(pid < 0)
+                    {
+                        for(const auto & [p, i] : workers)
+                            failed.push_back(units[i].part);
+                        workers.clear();
+                        running = 0;
+                        return;
+                    }
+                    auto it = std::find_if(workers.begin(), workers.end(), [pid](const std::pair<pid_t, size_t> & w) { return w.first == pid; });
+                    if(it == workers.end())
+                        continue;
+                    if(WIFEXITED(status) && WEXITSTATUS(status) == 0)
+                        record(units[it->second]);
+                    else
+                        failed.push_back(units[it->second].part);
+                    workers.erase(it);
+                    --running;
+                    return;
+                }
+            };
+            while(next < pending.size())
             {
-                t->SaveTo(subdir);
-                delete t;
+                if(running >= nworkers)
+                    reap();
+                std::cout.flush();
+                std::cerr.flush();
+                const Unit & u(units[pending[next]]);
+                pid_t pid(fork());
+                if(pid < 0)
+                    throw std::runtime_error("Failed to fork a worker process for " + u.part + ".");
+                if(pid == 0)
+                {
+                    /**
+                     * @brief Worker process: run the unit into its partial
+                     * file.
+                     * @details The worker exits without running the
+                     * destructors of the objects inherited from the parent
+                     * process.
+                     */
+                    int code(0);
+                    try
+                    {
+                        RunUnit(u);
+                    }
+                    catch(const std::exception & e)
+                    {
+                        std::cerr << "Error: " << u.part << " failed: " << e.what() << std::endl;
+                        code = 1;
+                    }
+                    std::cout.flush();
+                    std::cerr.flush();
+                    _exit(code);
+                }
+                workers.push_back({pid, pending[next]});
+                ++running;
+                ++next;
             }
-            dir->cd();
+            while(running > 0)
+                reap();
         }
-        f->Close();
+
+        if(!failed.empty())
+        {
+            std::string list;
+            for(const std::string & n : failed)
+                list += (list.empty() ? "" : ", ") + n;
+            throw std::runtime_error("Failed units: " + list + ". Rerun to process only the missing units.");
+        }
+
+        /**
+         * @brief Merge the partial files if every unit is complete.
+         * @details The manifest is read again so that the units completed by
+         * concurrent jobs are counted. Only the job that creates the lock
+         * file "<name>.merge.lock" (atomically, with O_EXCL) merges; it
+         * checks the manifest once more while holding the lock, as another
+         * job may have merged (and removed the partial files) in between.
+         * The lock records the host and process id of its owner and is
+         * removed whether or not the merge succeeds. A lock left behind by a
+         * job that was killed while merging is considered stale (and taken
+         * over) if its owner no longer runs on this host or if it is older
+         * than a day; a stale lock of a job on another host can also be
+         * removed by hand.
+         */
+        auto count_missing = [&]()
+        {
+            read_manifest();
+            size_t missing(0);
+            for(const Unit & u : units)
+                missing += completed.count(u.part) == 0;
+            return missing;
+        };
+        size_t missing(count_missing());
+        if(missing > 0)
+        {
+            std::cout << missing << " units are not yet complete; the output ROOT file will be merged by the job that completes them." << std::endl;
+            return;
+        }
+
+        const std::string lock(name + ".merge.lock");
+        char buffer[256] = {};
+        gethostname(buffer, sizeof(buffer) - 1);
+        const std::string host(buffer);
+        auto stale = [&]()
+        {
+            struct stat info;
+            if(stat(lock.c_str(), &info) != 0)
+                return true;
+            if(std::time(nullptr) - info.st_mtime > 24 * 3600)
+                return true;
+            std::ifstream input(lock);
+            std::string owner;
+            pid_t pid(0);
+            input >> owner >> pid;
+            return owner == host && pid > 0 && kill(pid, 0) != 0 && errno == ESRCH;
+        };
+        int fd(-1);
+        for(size_t attempt(0); attempt < 2 && fd < 0; ++attempt)
+        {
+            fd = open(lock.c_str(), O_CREAT | O_EXCL | O_WRONLY, 0644);
+            if(fd >= 0)
+                break;
+            if(errno != EEXIST)
+                throw std::runtime_error("Failed to create the merge lock " + lock + ".");
+            if(attempt > 0 || !stale())
+                break;
+            std::cout << "Removing the stale merge lock " << lock << "." << std::endl;
+            std::remove(lock.c_str());
+        }
+        if(fd < 0)
+        {
+            std::cout << "Another job is merging the partial files into " << name << ".root (remove " << lock << " if it is no longer running)." << std::endl;
+            return;
+        }
+        const std::string owner(host + " " + std::to_string(getpid()) + "\n");
+        if(write(fd, owner.data(), owner.size()) != static_cast<ssize_t>(owner.size()))
+            std::cerr << "Warning: failed to record the owner of the merge lock " << lock << "." << std::endl;
+        close(fd);
+
+        try
+        {
+            if(count_missing() > 0)
+            {
+                std::remove(lock.c_str());
+                std::cout << "The partial files have already been merged by another job." << std::endl;
+                return;
+            }
+            TFileMerger merger(false);
+            merger.OutputFile(std::string(name + ".root").c_str(), "RECREATE");
+            for(const Unit & u : units)
+                merger.AddFile(u.part.c_str(), false);
+            if(!merger.Merge())
+                throw std::runtime_error("Failed to merge the partial files into " + name + ".root. Partial files have been kept.");
+        }
+        catch(...)
+        {
+            std::remove(lock.c_str());
+            throw;
+        }
+        for(const Unit & u : units)
+            std::remove(u.part.c_str());
+        std::remove(manifest.c_str());
+        std::remove(lock.c_str());
     }
 }
 #endif // ANALYSIS_H
\ No newline at end of file
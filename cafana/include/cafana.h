@@ -0,0 +1,57 @@
+/**
+ * @file cafana.h
+ * @brief Umbrella header for the cuts, variables, and analysis classes of the
+ * cafana macros.
+ * @details This file includes all of the cafana headers and, when the macro
+ * is interpreted by ROOT, loads the compiled cafana shared library and
+ * declares the templates it provides (see instantiations.h) as "extern". The
+ * interpreter then calls the optimized, precompiled cuts and variables
+ * instead of JIT-compiling them, which removes most of the start-up time of
+ * the macros and speeds up the event loop. The library is loaded before the
+ * headers are included, as the per-spill singletons (see utilities.h) are
+ * then only declared and the single definition in the library is used. The
+ * ROOT dictionary (and module) of the library provides the declarations of
+ * the ana::Analysis class and the cuts, vars, pvars, pcuts, and utilities
+ * namespaces to the interpreter.
+ *
+ * The library must be on the library path (e.g. LD_LIBRARY_PATH) for the
+ * load to succeed. Macros may be run without the library by defining
+ * CAFANA_HEADER_ONLY before including this header, in which case everything
+ * is compiled from the headers as before.
+ * @author mueller@fnal.gov
+ */
+#ifndef CAFANA_H
+#define CAFANA_H
+
+#if defined(__CLING__) && !defined(__ROOTCLING__) && !defined(CAFANA_HEADER_ONLY)
+#include "Rtypes.h"
+R__LOAD_LIBRARY(libcafana)
+#define CAFANA_LIBRARY
+#endif
+
+#include "include/utilities.h"
+#include "include/particle_variables.h"
+#include "include/particle_cuts.h"
+#include "include/variables.h"
+#include "include/cuts.h"
+#include "include/muon2024/variables_muon2024.h"
+#include "include/muon2024/cuts_muon2024.h"
+#include "include/cosmics/cuts_cosmics.h"
+#include "include/spinevar.h"
+#include "include/spinecolumns.h"
+#include "include/spinetree.h"
+#include "include/spinevisitor.h"
+#include "include/analysis.h"
+#include "include/instantiations.h"
+
+#if defined(CAFANA_LIBRARY) && !defined(CAFANA_BUILD_LIBRARY)
+/**
+ * @brief Declare an explicit instantiation that is provided by the cafana
+ * shared library.
+ */
+#define CAFANA_EXTERN_TEMPLATE(RETURN, NAME, T) extern template RETURN NAME<T>(const T &);
+CAFANA_ALL_TEMPLATES(CAFANA_EXTERN_TEMPLATE)
+#undef CAFANA_EXTERN_TEMPLATE
+#endif
+
+#endif // CAFANA_H
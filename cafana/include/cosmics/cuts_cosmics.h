@@ -35,8 +35,8 @@ namespace cuts::cosmics
     template<class T>
         bool single_cosmic_muon_cut(const T & obj)
         {
-            std::vector<uint32_t> c(utilities::count_primaries(obj));
-            return obj.nu_id < 0 && c[0] == 0 && c[1] == 0 && c[2] == 1 && c[3] == 0 && c[4] == 0;
+            constexpr utilities::Topology t(utilities::Topology().exactly(0, 0).exactly(1, 0).exactly(2, 1).exactly(3, 0).exactly(4, 0));
+            return obj.nu_id < 0 && t.matches(utilities::count_primaries(obj));
         }
 }
 #endif // CUTS_COSMICS_H
\ No newline at end of file
@@ -10,9 +10,22 @@
 #ifndef CUTS_H
 #define CUTS_H
 #include <vector>
+#include <string>
+#include <utility>
 #include <numeric>
 #include <cmath>
+#include <chrono>
+#include <limits>
+#include <cstdint>
+#include <iostream>
 #include <algorithm>
+#include <stdexcept>
+#include <type_traits>
+#include <unordered_map>
+
+#include "TDirectory.h"
+#include "TH1D.h"
+#include "TNamed.h"
 
 #include "utilities.h"
 
@@ -66,7 +79,7 @@ namespace cuts
      * @note This cut is intended to be used for identifying neutrinos in
      * truth, which is useful for making signal definitions.
      */
-    bool neutrino(const caf::SRInteractionTruthDLPProxy & obj) { return obj.is_neutrino; }
+    inline bool neutrino(const caf::SRInteractionTruthDLPProxy & obj) { return obj.is_neutrino; }
 
     /**
      * @brief Apply a cut to select cosmogenic interactions.
@@ -78,7 +91,7 @@ namespace cuts
      * @note This cut is intended to be used for identifying cosmogenic
      * interactions in truth, which is useful for making background definitions.
      */
-    bool cosmic(const caf::SRInteractionTruthDLPProxy & obj) { return !obj.is_neutrino; }
+    inline bool cosmic(const caf::SRInteractionTruthDLPProxy & obj) { return !obj.is_neutrino; }
 
     /**
      * @brief Apply a fiducial volume cut; the interaction vertex must be
@@ -207,7 +220,7 @@ namespace cuts
      * @note This cut is intended to be used to select signal interactions
      * (neutrinos) that occur within the fiducial volume.
      */
-    bool fiducial_neutrino_cut(const caf::SRInteractionTruthDLPProxy & obj) { return fiducial_cut(obj) && neutrino(obj); }
+    inline bool fiducial_neutrino_cut(const caf::SRInteractionTruthDLPProxy & obj) { return fiducial_cut(obj) && neutrino(obj); }
 
     /**
      * @brief Apply a fiducial, containment, and neutrino cut (logical "and" of
@@ -221,7 +234,7 @@ namespace cuts
      * (neutrinos) that are fully contained within the detector and that occur
      * within the fiducial volume.
      */
-    bool fiducial_containment_neutrino_cut(const caf::SRInteractionTruthDLPProxy & obj) { return fiducial_cut(obj) && containment_cut(obj) && neutrino(obj); }
+    inline bool fiducial_containment_neutrino_cut(const caf::SRInteractionTruthDLPProxy & obj) { return fiducial_cut(obj) && containment_cut(obj) && neutrino(obj); }
 
     /**
      * @brief Apply a cut to select interactions with no primary charged pions.
@@ -235,8 +248,7 @@ namespace cuts
     template<class T>
         bool no_charged_pions(const T & obj)
         {
-            std::vector<uint32_t> c(utilities::count_primaries(obj));
-            return c[3] == 0;
+            return utilities::count_primaries(obj)[3] == 0;
         }
 
     /**
@@ -251,8 +263,8 @@ namespace cuts
     template<class T>
         bool no_showers(const T & obj)
         {
-            std::vector<uint32_t> c(utilities::count_primaries(obj));
-            return c[0] == 0 && c[1] == 0;
+            constexpr utilities::Topology t(utilities::Topology().exactly(0, 0).exactly(1, 0));
+            return t.matches(utilities::count_primaries(obj));
         }
 
     /**
@@ -267,8 +279,7 @@ namespace cuts
     template<class T>
         bool has_single_muon(const T & obj)
         {
-            std::vector<uint32_t> c(utilities::count_primaries(obj));
-            return c[2] == 1;
+            return utilities::count_primaries(obj)[2] == 1;
         }
 
     /**
@@ -283,8 +294,7 @@ namespace cuts
     template<class T>
         bool has_single_proton(const T & obj)
         {
-            std::vector<uint32_t> c(utilities::count_primaries(obj));
-            return c[4] == 1;
+            return utilities::count_primaries(obj)[4] == 1;
         }
 
     /**
@@ -299,8 +309,289 @@ namespace cuts
     template<class T>
         bool has_nonzero_protons(const T & obj)
         {
-            std::vector<uint32_t> c(utilities::count_primaries(obj));
-            return c[4] > 0;
+            return utilities::count_primaries(obj)[4] > 0;
+        }
+
+    /**
+     * @class CutFlowBase
+     * @brief Type-erased interface of a @ref CutFlow.
+     * @details This allows the @ref ana::Analysis class to reset and write the
+     * cut flows of an analysis without knowing the type of interaction they
+     * act on.
+     */
+    class CutFlowBase
+    {
+    public:
+        virtual ~CutFlowBase() = default;
+
+        /**
+         * @brief Reset the statistics of the cut flow (e.g. between samples).
+         * @return void
+         */
+        virtual void Reset() = 0;
+
+        /**
+         * @brief Write the cut flow histogram to a directory.
+         * @param dir the directory to write the histogram to.
+         * @return void
+         */
+        virtual void Write(TDirectory * dir) = 0;
+    };
+
+    /**
+     * @class CutFlow
+     * @brief A cut composed of a sequence of named cuts, with per-cut
+     * statistics.
+     * @details A CutFlow applies its cuts in sequence and stops at the first
+     * cut that fails (short-circuit evaluation), as in a selection written as
+     * "cut_a && cut_b && ...". For each cut it counts the candidates that
+     * reached the cut and the candidates that passed it, so that the cut flow
+     * (the number of candidates surviving each stage) can be written to the
+     * output file.
+     *
+     * With adaptive ordering enabled, every cut is evaluated on the first
+     * "window" candidates to measure its pass rate and its cost (time per
+     * evaluation). The cuts are then sorted by increasing cost / (1 - pass
+     * rate), which minimizes the expected cost of the selection for
+     * independent cuts: cheap cuts with a high rejection run first. The
+     * order is frozen for the remainder of the sample and the candidates of
+     * the calibration window are counted as if they had been evaluated in
+     * the final order, so the cut flow is exact in that order. The result of
+     * the selection does not depend on the order, but the order (which
+     * depends on the measured timings) may differ between jobs, so the
+     * statistics are written per cut rather than per stage (see
+     * @ref Write()).
+     *
+     * Inside a @ref utilities::SpillScope, the result for each interaction is
+     * cached by interaction id for the remainder of the spill. The cut is
+     * therefore evaluated (and counted) once per interaction, even if it is
+     * used by many variables. Outside of a SpillScope, every call is
+     * evaluated and counted.
+     *
+     * The SpineVar functions take cuts as function pointers, so a CutFlow
+     * with static storage duration is passed as @ref cutflow<FLOW>.
+     * @tparam T the type of interaction (true or reco).
+     */
+    template<class T>
+    class CutFlow : public CutFlowBase
+    {
+    public:
+        using type = T;
+
+        /**
+         * @brief Constructor for the CutFlow class.
+         * @param name the name of the cut flow (used in the histogram name).
+         * @param stages the names and functions of the cuts, in the order in
+         * which they are applied (unless the order is adaptive).
+         * @param adaptive whether to reorder the cuts using the measured pass
+         * rates and costs.
+         * @param window the number of candidates used to measure the pass
+         * rates and costs of the cuts when the order is adaptive.
+         * @throw std::invalid_argument if there are no cuts or more than 64.
+         */
+        CutFlow(std::string name, std::vector<std::pair<std::string, bool (*)(const T &)>> stages, bool adaptive = false, size_t window = 1000)
+            : name(name), stages(stages), adaptive(adaptive), window(std::max<size_t>(window, 1))
+        {
+            if(stages.empty() || stages.size() > 64)
+                throw std::invalid_argument("The cut flow " + name + " must have between 1 and 64 cuts.");
+            Reset();
+        }
+
+        /**
+         * @brief Apply the cut flow to an interaction.
+         * @param obj the interaction to select on.
+         * @return true if the interaction passes all of the cuts.
+         */
+        bool operator()(const T & obj)
+        {
+            utilities::SpillCache & spill(utilities::SpillCache::instance());
+            if(!spill.active())
+                return Evaluate(obj);
+            if(generation != spill.generation())
+            {
+                results.clear();
+                generation = spill.generation();
+            }
+            auto it = results.find(obj.id);
+            if(it == results.end())
+                it = results.emplace(int64_t(obj.id), Evaluate(obj)).first;
+            return it->second;
+        }
+
+        /**
+         * @brief Reset the statistics of the cut flow.
+         * @details The counts are cleared and, if the order is adaptive, the
+         * cuts are measured again on the next candidates.
+         * @return void
+         */
+        void Reset() override
+        {
+            candidates = 0;
+            evaluated.assign(stages.size(), 0);
+            passed.assign(stages.size(), 0);
+            seconds.assign(stages.size(), 0);
+            npassed.assign(stages.size(), 0);
+            order.resize(stages.size());
+            std::iota(order.begin(), order.end(), 0);
+            masks.clear();
+            results.clear();
+            generation = 0;
+            calibrating = adaptive;
+        }
+
+        /**
+         * @brief Write the cut flow histograms to a directory.
+         * @details The histograms "cutflow_<name>" and
+         * "cutflow_<name>_evaluated" have one bin with the number of
+         * candidates ("all") followed by one bin per cut (labelled with the
+         * name of the cut), in the order of construction, with the number of
+         * candidates that passed (were evaluated by) the cut. The bins do not
+         * depend on the order in which the cuts were applied, so the
+         * histograms of several jobs or shards (each of which may have chosen
+         * a different adaptive order) can be summed by hadd or TFileMerger.
+         * The pass rate of a cut on the candidates that reached it is the
+         * ratio of the two histograms. With a fixed order, "cutflow_<name>"
+         * is the number of candidates surviving each stage. The order in
+         * which the cuts were applied is written separately as the title of
+         * the TNamed "cutflow_<name>_order".
+         * @param dir the directory to write the histograms to.
+         * @return void
+         */
+        void Write(TDirectory * dir) override
+        {
+            if(calibrating)
+                Freeze();
+            auto write = [&](const std::string & hname, const std::vector<uint64_t> & counts)
+            {
+                TH1D h(hname.c_str(), (name + ";;Candidates").c_str(), stages.size() + 1, 0, stages.size() + 1);
+                h.SetDirectory(nullptr);
+                h.GetXaxis()->SetBinLabel(1, "all");
+                h.SetBinContent(1, candidates);
+                for(size_t k(0); k < stages.size(); ++k)
+                {
+                    h.GetXaxis()->SetBinLabel(k + 2, stages[k].first.c_str());
+                    h.SetBinContent(k + 2, counts[k]);
+                }
+                h.SetEntries(candidates);
+                dir->WriteTObject(&h);
+            };
+            write("cutflow_" + name, passed);
+            write("cutflow_" + name + "_evaluated", evaluated);
+            TNamed applied(("cutflow_" + name + "_order").c_str(), OrderString().c_str());
+            dir->WriteTObject(&applied);
+        }
+
+        /**
+         * @brief Get the order in which the cuts are applied.
+         * @return the indices of the cuts (in the order of construction).
+         */
+        const std::vector<size_t> & GetOrder() const { return order; }
+
+    private:
+        /**
+         * @brief Evaluate the cuts on a candidate and count the results.
+         * @param obj the interaction to select on.
+         * @return true if the interaction passes all of the cuts.
+         */
+        bool Evaluate(const T & obj)
+        {
+            ++candidates;
+            if(calibrating)
+            {
+                uint64_t mask(0);
+                for(size_t k(0); k < stages.size(); ++k)
+                {
+                    auto start(std::chrono::steady_clock::now());
+                    bool pass(stages[k].second(obj));
+                    seconds[k] += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                    npassed[k] += pass;
+                    mask |= uint64_t(pass) << k;
+                }
+                masks.push_back(mask);
+                if(masks.size() >= window)
+                    Freeze();
+                return mask == (~uint64_t(0) >> (64 - stages.size()));
+            }
+            for(size_t k : order)
+            {
+                ++evaluated[k];
+                if(!stages[k].second(obj))
+                    return false;
+                ++passed[k];
+            }
+            return true;
         }
+
+        /**
+         * @brief Fix the order of the cuts at the end of the calibration
+         * window.
+         * @details The cuts are sorted by increasing cost / (1 - pass rate),
+         * and the candidates of the calibration window are counted in the
+         * final order.
+         * @return void
+         */
+        void Freeze()
+        {
+            auto rank = [&](size_t k)
+            {
+                double rejection(1.0 - double(npassed[k]) / std::max<size_t>(masks.size(), 1));
+                return rejection > 0 ? seconds[k] / rejection : std::numeric_limits<double>::infinity();
+            };
+            std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return rank(a) < rank(b); });
+            for(uint64_t mask : masks)
+            {
+                for(size_t k : order)
+                {
+                    ++evaluated[k];
+                    if(!((mask >> k) & 1))
+                        break;
+                    ++passed[k];
+                }
+            }
+            masks.clear();
+            calibrating = false;
+            std::cout << "CutFlow " << name << ": applying the cuts in the order " << OrderString() << "." << std::endl;
+        }
+
+        /**
+         * @brief Get the names of the cuts in the order in which they are
+         * applied.
+         * @return the comma-separated names of the cuts.
+         */
+        std::string OrderString() const
+        {
+            std::string list;
+            for(size_t k : order)
+                list += (list.empty() ? "" : ", ") + stages[k].first;
+            return list;
+        }
+
+        std::string name;
+        std::vector<std::pair<std::string, bool (*)(const T &)>> stages;
+        bool adaptive;
+        size_t window;
+        bool calibrating;
+        uint64_t candidates;
+        std::vector<uint64_t> evaluated;
+        std::vector<uint64_t> passed;
+        std::vector<double> seconds;
+        std::vector<uint64_t> npassed;
+        std::vector<size_t> order;
+        std::vector<uint64_t> masks;
+        uint64_t generation;
+        std::unordered_map<int64_t, bool> results;
+    };
+
+    /**
+     * @brief Apply a CutFlow through a plain function.
+     * @details This wraps a CutFlow with static storage duration in a
+     * function, so that it can be passed as a cut to the SpineVar functions
+     * (e.g. "&cuts::cutflow<my_flow>").
+     * @tparam FLOW the CutFlow to apply.
+     * @param obj the interaction to select on.
+     * @return true if the interaction passes all of the cuts of the CutFlow.
+     */
+    template<auto & FLOW>
+        bool cutflow(const typename std::remove_reference_t<decltype(FLOW)>::type & obj) { return FLOW(obj); }
 }
 #endif
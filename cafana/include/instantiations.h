@@ -0,0 +1,137 @@
+/**
+ * @file instantiations.h
+ * @brief Lists of the cut, variable, and utility templates that are compiled
+ * into the cafana shared library.
+ * @details This file contains X-macro lists of the templated cuts, variables,
+ * and utility functions that are explicitly instantiated for the CAF proxy
+ * types in the cafana shared library. Each list is a function-like macro that
+ * takes another macro X(RETURN, NAME, TYPE) and applies it to every entry of
+ * the list. The lists are used twice: once in src/cafana.cc to emit the
+ * explicit instantiation definitions, and once in include/cafana.h to
+ * declare them "extern" so that macros loading the library call the compiled
+ * (optimized) code instead of instantiating and JIT-compiling their own copy.
+ *
+ * Templates that hold thread-local state (e.g. the interaction summary cache)
+ * must be listed, so that the library and the interpreter share a single
+ * instance of the state.
+ *
+ * Each template is listed only for the proxy types it supports (e.g. the
+ * flash variables only exist on reco interactions and the true neutrino
+ * variables only on true interactions). New cuts and variables may be added
+ * to the lists as needed; templates that are not listed remain usable from
+ * the headers alone.
+ * @author mueller@fnal.gov
+ */
+#ifndef INSTANTIATIONS_H
+#define INSTANTIATIONS_H
+
+#include "sbnanaobj/StandardRecord/Proxy/SRProxy.h"
+
+/**
+ * @brief Templates that are instantiated for a given interaction type (true
+ * or reco).
+ * @param X the macro to apply to each entry.
+ * @param T the interaction type.
+ */
+#define CAFANA_INTERACTION_TEMPLATES(X, T) \
+    X(bool, cuts::no_cut, T) \
+    X(bool, cuts::fiducial_cut, T) \
+    X(bool, cuts::containment_cut, T) \
+    X(bool, cuts::fiducial_containment_cut, T) \
+    X(bool, cuts::no_charged_pions, T) \
+    X(bool, cuts::no_showers, T) \
+    X(bool, cuts::has_single_muon, T) \
+    X(bool, cuts::has_single_proton, T) \
+    X(bool, cuts::has_nonzero_protons, T) \
+    X(bool, cuts::muon2024::topological_1mu1p_cut, T) \
+    X(bool, cuts::muon2024::topological_1muNp_cut, T) \
+    X(bool, cuts::muon2024::topological_1muX_cut, T) \
+    X(double, vars::containment, T) \
+    X(double, vars::fiducial, T) \
+    X(double, vars::visible_energy, T) \
+    X(double, vars::vertex_x, T) \
+    X(double, vars::vertex_y, T) \
+    X(double, vars::vertex_z, T) \
+    X(double, vars::leading_muon_end_x, T) \
+    X(double, vars::leading_muon_end_y, T) \
+    X(double, vars::leading_muon_end_z, T) \
+    X(double, vars::leading_proton_end_x, T) \
+    X(double, vars::leading_proton_end_y, T) \
+    X(double, vars::leading_proton_end_z, T) \
+    X(double, vars::leading_muon_ke, T) \
+    X(double, vars::leading_proton_ke, T) \
+    X(double, vars::leading_muon_pt, T) \
+    X(double, vars::leading_proton_pt, T) \
+    X(double, vars::muon_polar_angle, T) \
+    X(double, vars::muon_azimuthal_angle, T) \
+    X(double, vars::interaction_pt, T) \
+    X(double, vars::phiT, T) \
+    X(double, vars::alphaT, T) \
+    X(double, vars::muon2024::opening_angle, T) \
+    X(size_t, utilities::leading_muon_index, T) \
+    X(size_t, utilities::leading_proton_index, T) \
+    X(const utilities::InteractionSummary &, utilities::interaction_summary, T)
+
+/**
+ * @brief Templates that are instantiated only for the reco interaction type.
+ * @param X the macro to apply to each entry.
+ * @param T the (reco) interaction type.
+ */
+#define CAFANA_RECO_TEMPLATES(X, T) \
+    X(bool, cuts::valid_flashmatch, T) \
+    X(bool, cuts::flash_cut_bnb, T) \
+    X(bool, cuts::flash_cut_numi, T) \
+    X(bool, cuts::fiducial_containment_flash_cut_bnb, T) \
+    X(bool, cuts::fiducial_containment_flash_cut_numi, T) \
+    X(bool, cuts::muon2024::all_1mu1p_cut, T) \
+    X(bool, cuts::muon2024::all_1muNp_cut, T) \
+    X(bool, cuts::muon2024::all_1muX_cut, T) \
+    X(double, vars::flash_time, T) \
+    X(double, vars::flash_total_pe, T) \
+    X(double, vars::flash_hypothesis, T) \
+    X(double, vars::leading_muon_softmax, T) \
+    X(double, vars::leading_proton_softmax, T) \
+    X(double, vars::leading_muon_mip_softmax, T)
+
+/**
+ * @brief Templates that are instantiated only for the true interaction type.
+ * @param X the macro to apply to each entry.
+ * @param T the (true) interaction type.
+ */
+#define CAFANA_TRUE_TEMPLATES(X, T) \
+    X(double, vars::true_neutrino_energy, T) \
+    X(double, vars::true_neutrino_baseline, T) \
+    X(double, vars::true_neutrino_pdg, T) \
+    X(double, vars::true_neutrino_cc, T)
+
+/**
+ * @brief Templates that are instantiated for a given particle type (true or
+ * reco).
+ * @param X the macro to apply to each entry.
+ * @param T the particle type.
+ */
+#define CAFANA_PARTICLE_TEMPLATES(X, T) \
+    X(double, pvars::energy, T) \
+    X(double, pvars::ke, T) \
+    X(double, pvars::transverse_momentum, T) \
+    X(double, pvars::polar_angle, T) \
+    X(double, pvars::azimuthal_angle, T) \
+    X(double, pvars::end_x, T) \
+    X(double, pvars::end_y, T) \
+    X(double, pvars::end_z, T) \
+    X(bool, pcuts::final_state_signal, T)
+
+/**
+ * @brief Apply a macro to every template and proxy type compiled into the
+ * cafana shared library.
+ * @param X the macro to apply to each entry.
+ */
+#define CAFANA_ALL_TEMPLATES(X) \
+    CAFANA_INTERACTION_TEMPLATES(X, caf::SRInteractionDLPProxy) \
+    CAFANA_INTERACTION_TEMPLATES(X, caf::SRInteractionTruthDLPProxy) \
+    CAFANA_RECO_TEMPLATES(X, caf::SRInteractionDLPProxy) \
+    CAFANA_TRUE_TEMPLATES(X, caf::SRInteractionTruthDLPProxy) \
+    CAFANA_PARTICLE_TEMPLATES(X, caf::SRParticleDLPProxy) \
+    CAFANA_PARTICLE_TEMPLATES(X, caf::SRParticleTruthDLPProxy)
+
+#endif // INSTANTIATIONS_H
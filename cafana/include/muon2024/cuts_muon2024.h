@@ -41,8 +41,8 @@ namespace cuts::muon2024
     template<class T>
         bool topological_1mu1p_cut(const T & obj)
         {
-            std::vector<uint32_t> c(utilities::count_primaries(obj));
-            return c[0] == 0 && c[1] == 0 && c[2] == 1 && c[3] == 0 && c[4] == 1;
+            constexpr utilities::Topology t(utilities::Topology().exactly(0, 0).exactly(1, 0).exactly(2, 1).exactly(3, 0).exactly(4, 1));
+            return t.matches(utilities::count_primaries(obj));
         }
 
     /**
@@ -57,8 +57,8 @@ namespace cuts::muon2024
     template<class T>
         bool topological_1muNp_cut(const T & obj)
         {
-            std::vector<uint32_t> c(utilities::count_primaries(obj));
-            return c[0] == 0 && c[1] == 0 && c[2] == 1 && c[3] == 0 && c[4] >= 1;
+            constexpr utilities::Topology t(utilities::Topology().exactly(0, 0).exactly(1, 0).exactly(2, 1).exactly(3, 0).at_least(4, 1));
+            return t.matches(utilities::count_primaries(obj));
         }
     
     /**
@@ -73,8 +73,8 @@ namespace cuts::muon2024
     template<class T>
         bool topological_1muX_cut(const T & obj)
         {
-            std::vector<uint32_t> c(utilities::count_primaries(obj));
-            return c[2] == 1;
+            constexpr utilities::Topology t(utilities::Topology().exactly(2, 1));
+            return t.matches(utilities::count_primaries(obj));
         }
 
     /**
@@ -132,7 +132,7 @@ namespace cuts::muon2024
      * @note This cut is intended to be used for the muon2024 analysis for
      * defining the signal.
      */
-    bool signal_1mu1p(const caf::SRInteractionTruthDLPProxy & obj) { return neutrino(obj) && fiducial_cut(obj) && containment_cut(obj) && topological_1mu1p_cut(obj); }
+    inline bool signal_1mu1p(const caf::SRInteractionTruthDLPProxy & obj) { return neutrino(obj) && fiducial_cut(obj) && containment_cut(obj) && topological_1mu1p_cut(obj); }
 
     /**
      * @brief Apply a cut to select the 1mu1p non-signal.
@@ -145,7 +145,7 @@ namespace cuts::muon2024
      * @note This cut is intended to be used for the muon2024 analysis for
      * defining a complement to the signal.
      */
-    bool nonsignal_1mu1p(const caf::SRInteractionTruthDLPProxy & obj) { return neutrino(obj) && !(fiducial_cut(obj) && containment_cut(obj)) && topological_1mu1p_cut(obj); }
+    inline bool nonsignal_1mu1p(const caf::SRInteractionTruthDLPProxy & obj) { return neutrino(obj) && !(fiducial_cut(obj) && containment_cut(obj)) && topological_1mu1p_cut(obj); }
 
     /**
      * @brief Apply a cut to select the 1muNp signal.
@@ -157,7 +157,7 @@ namespace cuts::muon2024
      * @note This cut is intended to be used for the muon2024 analysis for
      * defining the signal.
      */
-    bool signal_1muNp(const caf::SRInteractionTruthDLPProxy & obj) { return neutrino(obj) && fiducial_cut(obj) && containment_cut(obj) && topological_1muNp_cut(obj); }
+    inline bool signal_1muNp(const caf::SRInteractionTruthDLPProxy & obj) { return neutrino(obj) && fiducial_cut(obj) && containment_cut(obj) && topological_1muNp_cut(obj); }
 
     /**
      * @brief Apply a cut to select the 1muNp non-signal.
@@ -170,7 +170,7 @@ namespace cuts::muon2024
      * @note This cut is intended to be used for the muon2024 analysis for
      * defining a complement to the signal.
      */
-    bool nonsignal_1muNp(const caf::SRInteractionTruthDLPProxy & obj) { return neutrino(obj) && !(fiducial_cut(obj) && containment_cut(obj)) && topological_1muNp_cut(obj); }
+    inline bool nonsignal_1muNp(const caf::SRInteractionTruthDLPProxy & obj) { return neutrino(obj) && !(fiducial_cut(obj) && containment_cut(obj)) && topological_1muNp_cut(obj); }
 
     /**
      * @brief Apply a cut to select the 1muX signal.
@@ -183,7 +183,7 @@ namespace cuts::muon2024
      * @note This cut is intended to be used for the muon2024 analysis for
      * defining the signal.
      */
-    bool signal_1muX(const caf::SRInteractionTruthDLPProxy & obj) { return neutrino(obj) && fiducial_cut(obj) && containment_cut(obj) && topological_1muX_cut(obj); }
+    inline bool signal_1muX(const caf::SRInteractionTruthDLPProxy & obj) { return neutrino(obj) && fiducial_cut(obj) && containment_cut(obj) && topological_1muX_cut(obj); }
 
     /**
      * @brief Apply a cut to select the 1muX non-signal.
@@ -196,6 +196,6 @@ namespace cuts::muon2024
      * @note This cut is intended to be used for the muon2024 analysis for
      * defining a complement to the signal.
      */
-    bool nonsignal_1muX(const caf::SRInteractionTruthDLPProxy & obj) { return neutrino(obj) && !(fiducial_cut(obj) && containment_cut(obj)) && topological_1muX_cut(obj); }
+    inline bool nonsignal_1muX(const caf::SRInteractionTruthDLPProxy & obj) { return neutrino(obj) && !(fiducial_cut(obj) && containment_cut(obj)) && topological_1muX_cut(obj); }
 }
 #endif // CUTS_MUON2024_H
\ No newline at end of file
@@ -51,7 +51,7 @@ namespace vars::muon2024
      * @param obj The interaction to apply the variable on.
      * @return the enumerated category of the interaction.
     */
-    double category(const caf::SRInteractionTruthDLPProxy & obj)
+    inline double category(const caf::SRInteractionTruthDLPProxy & obj)
     {
         double cat(7);
         if(cuts::muon2024::signal_1mu1p(obj)) cat = 0;
@@ -10,6 +10,8 @@
 */
 #ifndef PARTICLE_VARIABLES_H
 #define PARTICLE_VARIABLES_H
+#include <cmath>
+
 #define ELECTRON_MASS 0.5109989461
 #define MUON_MASS 105.6583745
 #define PION_MASS 139.57039
@@ -203,7 +205,7 @@ namespace pvars
      * @param p the particle to apply the variable on.
      * @return the muon softmax score of the particle.
      */
-    double muon_softmax(const caf::SRParticleDLPProxy & p)
+    inline double muon_softmax(const caf::SRParticleDLPProxy & p)
     {
         return p.pid_scores[2];
     }
@@ -216,7 +218,7 @@ namespace pvars
      * @param p the particle to apply the variable on.
      * @return the pion softmax score of the particle.
      */
-    double pion_softmax(const caf::SRParticleDLPProxy & p)
+    inline double pion_softmax(const caf::SRParticleDLPProxy & p)
     {
         return p.pid_scores[3];
     }
@@ -229,7 +231,7 @@ namespace pvars
      * @param p the particle to apply the variable on.
      * @return the proton softmax score of the particle.
      */
-    double proton_softmax(const caf::SRParticleDLPProxy & p)
+    inline double proton_softmax(const caf::SRParticleDLPProxy & p)
     {
         return p.pid_scores[4];
     }
@@ -242,7 +244,7 @@ namespace pvars
      * @param p the particle to apply the variable on.
      * @return the "MIP" softmax score of the particle.
      */
-    double mip_softmax(const caf::SRParticleDLPProxy & p)
+    inline double mip_softmax(const caf::SRParticleDLPProxy & p)
     {
         return p.pid_scores[2] + p.pid_scores[3];
     }
@@ -255,7 +257,7 @@ namespace pvars
      * @param p the particle to apply the variable on.
      * @return the "hadron" softmax score of the particle.
      */
-    double hadron_softmax(const caf::SRParticleDLPProxy & p)
+    inline double hadron_softmax(const caf::SRParticleDLPProxy & p)
     {
         return p.pid_scores[3] + p.pid_scores[4];
     }
@@ -269,7 +271,7 @@ namespace pvars
      * @param p the particle to apply the variable on.
      * @return the primary softmax score of the particle.
      */
-    double primary_softmax(const caf::SRParticleDLPProxy & p)
+    inline double primary_softmax(const caf::SRParticleDLPProxy & p)
     {
         return p.primary_scores[1];
     }
@@ -283,7 +285,7 @@ namespace pvars
      * @param p the particle to apply the variable on.
      * @return the secondary softmax score of the particle.
      */
-    double secondary_softmax(const caf::SRParticleDLPProxy & p)
+    inline double secondary_softmax(const caf::SRParticleDLPProxy & p)
     {
         return p.primary_scores[0];
     }
@@ -2,6 +2,10 @@
  * @file preprocessor.h
  * @brief Header file for preprocessor macros that streamline variable
  * declarations.
+ * @details Each macro declares a separate lambda with its own loop over the
+ * interactions of the spill. Prefer registering the variables with a
+ * SpineVisitor (see spinevisitor.h), which evaluates all of them in a single
+ * pass.
  * @author mueller@fnal.gov
 */
 #ifndef PREPROCESSOR_H
@@ -0,0 +1,211 @@
+/**
+ * @file spinecolumns.h
+ * @brief Header file for the building blocks shared by the SpineTree and
+ * SpineVisitor classes.
+ * @details This file contains the pieces of the fused interaction loops of
+ * the SpineTree (see spinetree.h) and the SpineVisitor (see spinevisitor.h)
+ * that do not depend on how the columns are registered: the candidate
+ * (a selected interaction and its matched twin), the selection and the
+ * broadcasting of interaction and particle variables onto a candidate, the
+ * loop over the candidates of a spill, and the per-spill cache from which
+ * the columns are handed out to the SpillMultiVars. The broadcasting rules
+ * are those of the SpineVar functions (see spinevar.h).
+ * @author mueller@fnal.gov
+ */
+#ifndef SPINECOLUMNS_H
+#define SPINECOLUMNS_H
+#include <vector>
+#include <type_traits>
+
+#include "include/spinevar.h"
+#include "include/utilities.h"
+
+namespace ana::spine
+{
+    /**
+     * @struct Candidate
+     * @brief An interaction passing the selection and its matched twin.
+     * @details For reco interactions, "truth" is the matched true
+     * interaction (or nullptr if the interaction is not matched or the
+     * record is data). For true interactions, "reco" is the matched reco
+     * interaction.
+     */
+    struct Candidate
+    {
+        const RTYPE * reco;
+        const TTYPE * truth;
+    };
+
+    /**
+     * @brief Loop over the candidates of a spill.
+     * @details For reco interactions, every interaction is a candidate and
+     * its truth match is resolved (except on data). For true interactions,
+     * only the interactions matched to a reco interaction are candidates.
+     * @tparam CUTTYPE the type of interaction to loop over (reco or true).
+     * @tparam F the type of the function called with each candidate.
+     * @param sr the StandardRecord proxy of the spill.
+     * @param f the function, called as f(const Candidate &, bool is_mc).
+     * @return void
+     */
+    template<class CUTTYPE, class F>
+    inline void for_each_candidate(const caf::Proxy<caf::StandardRecord> * sr, F && f)
+    {
+        bool is_mc(sr->ndlp_true != 0);
+        if constexpr(std::is_same_v<CUTTYPE, RTYPE>)
+        {
+            for(auto const & i : sr->dlp)
+            {
+                const TTYPE * t(i.match_ids.size() > 0 && is_mc ? &sr->dlp_true[i.match_ids[0]] : nullptr);
+                f(Candidate{&i, t}, is_mc);
+            }
+        }
+        else
+        {
+            for(auto const & i : sr->dlp_true)
+            {
+                if(i.match_ids.size() > 0)
+                    f(Candidate{&sr->dlp[i.match_ids[0]], &i}, is_mc);
+            }
+        }
+    }
+
+    /**
+     * @brief Apply a selection to a candidate.
+     * @details The category cut is only applied when looping over reco
+     * interactions, and then to the matched true interaction (except on
+     * data).
+     * @tparam CUTTYPE the type of interaction looped over (reco or true).
+     * @param c the candidate.
+     * @param is_mc whether the record is simulation.
+     * @param fcut the function implementing the cut.
+     * @param fcat the function implementing the category cut.
+     * @return true if the candidate passes the selection.
+     */
+    template<class CUTTYPE, class FCUT, class FCAT>
+    inline bool select(const Candidate & c, bool is_mc, const FCUT & fcut, const FCAT & fcat)
+    {
+        if constexpr(std::is_same_v<CUTTYPE, RTYPE>)
+            return fcut(*c.reco) && ((c.truth && fcat(*c.truth)) || !is_mc);
+        else
+            return fcut(*c.truth);
+    }
+
+    /**
+     * @brief Evaluate a variable on the selected interaction (or its matched
+     * twin).
+     * @details Variables on the true interaction receive a value of -1 if
+     * the selected reco interaction is not matched.
+     * @tparam VARTYPE the type of interaction to apply the variable on.
+     * @param c the candidate.
+     * @param fvar the function implementing the variable.
+     * @return the value of the variable.
+     */
+    template<class VARTYPE, class FVAR>
+    inline double evaluate(const Candidate & c, const FVAR & fvar)
+    {
+        if constexpr(std::is_same_v<VARTYPE, TTYPE>)
+            return c.truth ? fvar(*c.truth) : -1.0;
+        else if constexpr(std::is_same_v<VARTYPE, RTYPE>)
+            return c.reco ? fvar(*c.reco) : -1.0;
+        else
+            static_assert(std::is_same_v<VARTYPE, TTYPE> || std::is_same_v<VARTYPE, RTYPE>, "Unsupported interaction type.");
+    }
+
+    /**
+     * @brief Evaluate a variable on an identified particle of the selected
+     * interaction (or its matched twin).
+     * @details The particle of interest is identified (by index) on an
+     * interaction of type U, and the variable is applied to that particle
+     * or, for a reco variable on a true particle, to its matched reco
+     * particle (see @ref utilities::matched_reco_particle()). Variables that
+     * cannot be evaluated because of a missing match receive a value of -1.
+     * @tparam VARTYPE the type of particle to apply the variable on.
+     * @tparam U the type of interaction used to identify the particle.
+     * @param c the candidate.
+     * @param sr the StandardRecord proxy of the spill.
+     * @param fvar the function implementing the variable.
+     * @param pident the function to identify the particle of interest.
+     * @return the value of the variable.
+     */
+    template<class VARTYPE, class U, class FVAR, class PIDENT>
+    inline double evaluate(const Candidate & c, const caf::Proxy<caf::StandardRecord> * sr, const FVAR & fvar, const PIDENT & pident)
+    {
+        if constexpr(std::is_same_v<VARTYPE, TTYPEP> && std::is_same_v<U, TTYPE>)
+            return c.truth ? fvar(c.truth->particles[pident(*c.truth)]) : -1.0;
+        else if constexpr(std::is_same_v<VARTYPE, RTYPEP> && std::is_same_v<U, RTYPE>)
+            return c.reco ? fvar(c.reco->particles[pident(*c.reco)]) : -1.0;
+        else if constexpr(std::is_same_v<VARTYPE, RTYPEP> && std::is_same_v<U, TTYPE>)
+        {
+            if(!c.truth)
+                return -1.0;
+            const RTYPEP * r(utilities::matched_reco_particle(sr, c.truth->particles[pident(*c.truth)]));
+            return r != nullptr ? fvar(*r) : -1.0;
+        }
+        else
+            static_assert(std::is_same_v<VARTYPE, TTYPEP> || std::is_same_v<VARTYPE, RTYPEP>, "Unsupported particle type.");
+    }
+
+    /**
+     * @class ColumnCache
+     * @brief Per-spill cache of the columns of a fused interaction loop.
+     * @details All columns are filled in a single pass over the spill and
+     * each is then handed out to its SpillMultiVar. The cache is refilled
+     * whenever the spill changes, which is detected either by a change of
+     * the record header (run, subrun, event) or by a column being requested
+     * a second time for the same header. CAFAna reuses a single proxy for
+     * every spill, so in the latter case the per-spill caches (see
+     * @ref utilities::SpillScope) are told explicitly that this is a new
+     * spill.
+     */
+    class ColumnCache
+    {
+    public:
+        /**
+         * @brief Hand out a column of the cache for a spill.
+         * @details If the cache is refilled, every column is cleared and the
+         * fill function is called inside a @ref utilities::SpillScope for the
+         * spill.
+         * @tparam F the type of the fill function.
+         * @param sr the StandardRecord proxy of the spill.
+         * @param c the index of the column.
+         * @param n the number of columns.
+         * @param fill the function filling the columns, called as
+         * fill(sr) and appending to @ref Column().
+         * @return the column of variable values.
+         */
+        template<class F>
+        std::vector<double> Consume(const caf::Proxy<caf::StandardRecord> * sr, size_t c, size_t n, F && fill)
+        {
+            bool same(valid && run == sr->hdr.run && subrun == sr->hdr.subrun && evt == sr->hdr.evt);
+            if(!same || consumed[c])
+            {
+                run = sr->hdr.run;
+                subrun = sr->hdr.subrun;
+                evt = sr->hdr.evt;
+                valid = true;
+                buffers.resize(n);
+                for(std::vector<double> & b : buffers)
+                    b.clear();
+                consumed.assign(n, false);
+                utilities::SpillScope scope(sr, same);
+                fill(sr);
+            }
+            consumed[c] = true;
+            return std::move(buffers[c]);
+        }
+
+        /**
+         * @brief Get a column of the cache while it is being filled.
+         * @param c the index of the column.
+         * @return the column.
+         */
+        std::vector<double> & Column(size_t c) { return buffers[c]; }
+
+    private:
+        bool valid = false;
+        unsigned run = 0, subrun = 0, evt = 0;
+        std::vector<std::vector<double>> buffers;
+        std::vector<bool> consumed;
+    };
+} // namespace ana::spine
+#endif // SPINECOLUMNS_H
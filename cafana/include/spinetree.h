@@ -0,0 +1,343 @@
+/**
+ * @file spinetree.h
+ * @brief Header file for the SpineTree class, a builder for sets of
+ * SpillMultiVars that share a single selection.
+ * @details This file contains the implementation of the SpineTree class. A
+ * SpineTree collects a set of named variables that are all evaluated on the
+ * same interactions (those passing a cut and a category cut). Unlike the
+ * SpineVar functions, which each walk the interactions and re-evaluate the
+ * cut independently, the SpineTree evaluates the cut and category once per
+ * interaction and then evaluates every registered variable in the same pass.
+ * The results are stored in per-spill column buffers that are handed out to
+ * the SpillMultiVars that make up the Tree. A SpineTree may hold several
+ * named selections that share the same variables, in which case all of the
+ * selections are evaluated in the same pass over the spill.
+ * @author mueller@fnal.gov
+ */
+#ifndef SPINETREE_H
+#define SPINETREE_H
+#include <vector>
+#include <string>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <functional>
+
+#include "sbnana/CAFAna/Core/MultiVar.h"
+#include "include/spinevar.h"
+#include "include/spinecolumns.h"
+
+namespace ana
+{
+    /**
+     * @class SpineTree
+     * @brief Builder for a set of variables that share a single selection.
+     * @details This class collects a set of named variables that are evaluated
+     * on the interactions passing a cut (and category cut). The interaction
+     * loop, the cut, the category cut, and the truth matching are performed
+     * once per spill and shared by all variables. The class mirrors the
+     * broadcasting rules of the SpineVar functions, so a variable registered
+     * with AddVar<VARTYPE>(name, fvar) produces the same column as
+     * SpineVar<VARTYPE, CUTTYPE>(fvar, fcut, fcat), and likewise for the
+     * particle-level variables.
+     *
+     * The SpillMultiVars returned by @ref GetVars() each read their column
+     * from a cache that is shared by all variables of the SpineTree (see
+     * @ref spine::ColumnCache). The cache is recomputed whenever the spill
+     * changes, which is detected either by a change of the record header
+     * (run, subrun, event) or by a column being requested a second time for
+     * the same header.
+     *
+     * Additional selections (a cut and a category cut) can be added with
+     * @ref AddSelection(). Every selection produces the same set of columns
+     * (see @ref GetVars(const std::string &) const), and all of them are
+     * evaluated in a single loop over the interactions of the spill: the
+     * truth matching is done once per interaction, the per-interaction
+     * summaries (e.g. the primary counts behind the topological cuts) are
+     * shared through the @ref utilities::SpillScope, and each variable is
+     * evaluated once per interaction that passes at least one of the
+     * selections. This replaces a set of separate SpineTrees (and separate
+     * processing of the same CAF files) with a single one.
+     * @tparam CUTTYPE the type of interaction to loop over (reco or true).
+     */
+    template<class CUTTYPE>
+    class SpineTree
+    {
+    public:
+        /**
+         * @brief An interaction passing the selection and its matched twin
+         * (see @ref spine::Candidate).
+         */
+        using Candidate = spine::Candidate;
+
+        /**
+         * @brief Constructor for the SpineTree class without any selection.
+         * @details The selections are added with @ref AddSelection().
+         */
+        SpineTree() : state(std::make_shared<State>()) {}
+
+        /**
+         * @brief Constructor for the SpineTree class.
+         * @details The cut and category cut form the default (unnamed)
+         * selection, which is the one returned by @ref GetVars().
+         * @param fcut the function implementing the cut.
+         * @param fcat the function implementing the category cut.
+         */
+        SpineTree(std::function<bool(const CUTTYPE &)> fcut, std::function<bool(const TTYPE &)> fcat)
+            : state(std::make_shared<State>())
+        {
+            AddSelection("", fcut, fcat);
+        }
+
+        /**
+         * @brief Constructor for the SpineTree class from function pointers.
+         * @details This overload allows templated cuts (e.g.
+         * &cuts::muon2024::all_1muNp_cut) to be passed in the same way as to
+         * the SpineVar functions.
+         * @param fcut the function implementing the cut.
+         * @param fcat the function implementing the category cut.
+         */
+        SpineTree(bool (*fcut)(const CUTTYPE &), bool (*fcat)(const TTYPE &))
+            : SpineTree(std::function<bool(const CUTTYPE &)>(fcut), std::function<bool(const TTYPE &)>(fcat)) {}
+
+        /**
+         * @brief Add a named selection to the SpineTree.
+         * @details The category cut is only applied when looping over reco
+         * interactions (as in the SpineVar functions).
+         * @param name the name of the selection.
+         * @param fcut the function implementing the cut.
+         * @param fcat the function implementing the category cut.
+         * @return void
+         * @throw std::invalid_argument if a selection with the same name
+         * already exists.
+         */
+        void AddSelection(const std::string & name, std::function<bool(const CUTTYPE &)> fcut, std::function<bool(const TTYPE &)> fcat)
+        {
+            for(const Selection & sel : state->selections)
+            {
+                if(sel.name == name)
+                    throw std::invalid_argument("The selection \"" + name + "\" is already defined.");
+            }
+            state->selections.push_back({name, fcut, fcat});
+        }
+
+        /**
+         * @brief Add a named selection to the SpineTree from function
+         * pointers.
+         * @param name the name of the selection.
+         * @param fcut the function implementing the cut.
+         * @param fcat the function implementing the category cut.
+         * @return void
+         */
+        void AddSelection(const std::string & name, bool (*fcut)(const CUTTYPE &), bool (*fcat)(const TTYPE &))
+        {
+            AddSelection(name, std::function<bool(const CUTTYPE &)>(fcut), std::function<bool(const TTYPE &)>(fcat));
+        }
+
+        /**
+         * @brief Get the names of the selections of the SpineTree.
+         * @return the names of the selections, in the order they were added.
+         */
+        std::vector<std::string> GetSelections() const
+        {
+            std::vector<std::string> names;
+            for(const Selection & sel : state->selections)
+                names.push_back(sel.name);
+            return names;
+        }
+
+        /**
+         * @brief Add a variable on the selected interaction (or its matched
+         * twin) to the SpineTree.
+         * @details Variables on the true interaction receive a value of -1 if
+         * the selected reco interaction is not matched.
+         * @tparam VARTYPE the type of interaction to apply the variable on.
+         * @param name the name of the variable in the output TTree.
+         * @param fvar the function implementing the variable.
+         * @return void
+         */
+        template<class VARTYPE>
+        void AddVar(const std::string & name, double (*fvar)(const VARTYPE &))
+        {
+            AddColumn(name, [fvar](const Candidate & c, const caf::Proxy<caf::StandardRecord> *) { return spine::evaluate<VARTYPE>(c, fvar); });
+        }
+
+        /**
+         * @brief Add a variable on an identified particle of the selected
+         * interaction (or its matched twin) to the SpineTree.
+         * @details The particle of interest is identified (by index) on an
+         * interaction of type U, and the variable is applied to that particle
+         * or to its matched twin if VARTYPE is of the other kind. Variables
+         * that cannot be evaluated because of a missing match receive a value
+         * of -1.
+         * @tparam VARTYPE the type of particle to apply the variable on.
+         * @tparam U the type of interaction used to identify the particle.
+         * @param name the name of the variable in the output TTree.
+         * @param fvar the function implementing the variable.
+         * @param pident the function to identify the particle of interest.
+         * @return void
+         */
+        template<class VARTYPE, class U>
+        void AddVar(const std::string & name, double (*fvar)(const VARTYPE &), size_t (*pident)(const U &))
+        {
+            AddColumn(name, [fvar, pident](const Candidate & c, const caf::Proxy<caf::StandardRecord> * sr)
+            {
+                return spine::evaluate<VARTYPE, U>(c, sr, fvar, pident);
+            });
+        }
+
+        /**
+         * @brief Get the SpillMultiVars implementing the variables of the
+         * first selection.
+         * @details This function returns a map of variable names and the
+         * SpillMultiVars that read the corresponding column of the shared
+         * per-spill cache. The map can be passed directly to
+         * @ref Analysis::AddTree().
+         * @return the map of variable names and SpillMultiVars.
+         * @throw std::runtime_error if the SpineTree has no selection.
+         */
+        std::map<std::string, ana::SpillMultiVar> GetVars() const
+        {
+            if(state->selections.empty())
+                throw std::runtime_error("The SpineTree has no selection.");
+            return SelectionVars(0);
+        }
+
+        /**
+         * @brief Get the SpillMultiVars implementing the variables of a named
+         * selection.
+         * @param selection the name of the selection.
+         * @return the map of variable names and SpillMultiVars.
+         * @throw std::invalid_argument if the selection does not exist.
+         */
+        std::map<std::string, ana::SpillMultiVar> GetVars(const std::string & selection) const
+        {
+            for(size_t k(0); k < state->selections.size(); ++k)
+            {
+                if(state->selections[k].name == selection)
+                    return SelectionVars(k);
+            }
+            throw std::invalid_argument("The selection \"" + selection + "\" is not defined.");
+        }
+
+    private:
+        /**
+         * @struct Selection
+         * @brief A named cut and category cut.
+         */
+        struct Selection
+        {
+            std::string name;
+            std::function<bool(const CUTTYPE &)> fcut;
+            std::function<bool(const TTYPE &)> fcat;
+        };
+
+        /**
+         * @struct State
+         * @brief The configuration and per-spill cache shared by all variables
+         * of the SpineTree.
+         * @details The column c of selection s is stored in the cache at
+         * index s * columns.size() + c.
+         */
+        struct State
+        {
+            std::vector<Selection> selections;
+            std::vector<std::string> names;
+            std::vector<std::function<double(const Candidate &, const caf::Proxy<caf::StandardRecord> *)>> columns;
+            spine::ColumnCache cache;
+
+            /**
+             * @brief Evaluate the selections and all columns for a spill.
+             * @details The interactions passing at least one selection are
+             * collected once (with their truth match), and the indices of
+             * the interactions passing each selection are recorded. Each
+             * column is then evaluated once per collected interaction and
+             * the values are distributed to the columns of the selections.
+             * @param sr the StandardRecord proxy of the spill.
+             * @return void
+             */
+            void Fill(const caf::Proxy<caf::StandardRecord> * sr)
+            {
+                std::vector<Candidate> candidates;
+                std::vector<std::vector<size_t>> members(selections.size());
+                spine::for_each_candidate<CUTTYPE>(sr, [&](const Candidate & k, bool is_mc)
+                {
+                    bool any(false);
+                    for(size_t s(0); s < selections.size(); ++s)
+                    {
+                        if(spine::select<CUTTYPE>(k, is_mc, selections[s].fcut, selections[s].fcat))
+                        {
+                            members[s].push_back(candidates.size());
+                            any = true;
+                        }
+                    }
+                    if(any)
+                        candidates.push_back(k);
+                });
+
+                std::vector<double> values(candidates.size());
+                for(size_t c(0); c < columns.size(); ++c)
+                {
+                    for(size_t k(0); k < candidates.size(); ++k)
+                        values[k] = columns[c](candidates[k], sr);
+                    for(size_t s(0); s < selections.size(); ++s)
+                    {
+                        std::vector<double> & column(cache.Column(s * columns.size() + c));
+                        column.reserve(members[s].size());
+                        for(size_t k : members[s])
+                            column.push_back(values[k]);
+                    }
+                }
+            }
+
+            /**
+             * @brief Hand out a column of the cache for a spill.
+             * @details The cache is refilled if the spill has changed (see
+             * @ref spine::ColumnCache).
+             * @param sr the StandardRecord proxy of the spill.
+             * @param s the index of the selection.
+             * @param c the index of the column.
+             * @return the column of variable values.
+             */
+            std::vector<double> Consume(const caf::Proxy<caf::StandardRecord> * sr, size_t s, size_t c)
+            {
+                return cache.Consume(sr, s * columns.size() + c, selections.size() * columns.size(), [this](const caf::Proxy<caf::StandardRecord> * r) { Fill(r); });
+            }
+        };
+
+        /**
+         * @brief Get the SpillMultiVars implementing the variables of a
+         * selection.
+         * @param k the index of the selection.
+         * @return the map of variable names and SpillMultiVars.
+         */
+        std::map<std::string, ana::SpillMultiVar> SelectionVars(size_t k) const
+        {
+            std::map<std::string, ana::SpillMultiVar> vars;
+            for(size_t c(0); c < state->names.size(); ++c)
+            {
+                std::shared_ptr<State> s(state);
+                vars.insert({state->names[c], ana::SpillMultiVar([s, k, c](const caf::Proxy<caf::StandardRecord> * sr) -> std::vector<double>
+                {
+                    return s->Consume(sr, k, c);
+                })});
+            }
+            return vars;
+        }
+
+        /**
+         * @brief Register a column with the shared state.
+         * @param name the name of the variable.
+         * @param f the function evaluating the column on a candidate.
+         * @return void
+         */
+        void AddColumn(const std::string & name, std::function<double(const Candidate &, const caf::Proxy<caf::StandardRecord> *)> f)
+        {
+            state->names.push_back(name);
+            state->columns.push_back(f);
+        }
+
+        std::shared_ptr<State> state;
+    };
+} // namespace ana
+#endif // SPINETREE_H
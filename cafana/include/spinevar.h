@@ -17,6 +17,7 @@
 #include <iostream>
 
 #include "sbnana/CAFAna/Core/MultiVar.h"
+#include "include/utilities.h"
 
 /**
  * @brief Macro to wrap a boolean function in a lambda function.
@@ -64,6 +65,7 @@ ana::SpillMultiVar SpineVar(double (*fvar)(const VARTYPE &), bool (*fcut)(const
     {
         return ana::SpillMultiVar([fvar, fcut, fcat](const caf::Proxy<caf::StandardRecord> * sr) -> std::vector<double>
         {
+            utilities::SpillScope scope(sr);
             std::vector<double> var;
             bool is_mc(sr->ndlp_true != 0);
             for(auto const& i : sr->dlp)
@@ -90,6 +92,7 @@ ana::SpillMultiVar SpineVar(double (*fvar)(const VARTYPE &), bool (*fcut)(const
     {
         return ana::SpillMultiVar([fvar, fcut, fcat](const caf::Proxy<caf::StandardRecord> * sr) -> std::vector<double>
         {
+            utilities::SpillScope scope(sr);
             std::vector<double> var;
             bool is_mc(sr->ndlp_true != 0);
             for(auto const& i : sr->dlp)
@@ -115,6 +118,7 @@ ana::SpillMultiVar SpineVar(double (*fvar)(const VARTYPE &), bool (*fcut)(const
     {
         return ana::SpillMultiVar([fvar, fcut, fcat](const caf::Proxy<caf::StandardRecord> * sr) -> std::vector<double>
         {
+            utilities::SpillScope scope(sr);
             std::vector<double> var;
             for(auto const& i : sr->dlp_true)
             {
@@ -138,6 +142,7 @@ ana::SpillMultiVar SpineVar(double (*fvar)(const VARTYPE &), bool (*fcut)(const
     {
         return ana::SpillMultiVar([fvar, fcut, fcat](const caf::Proxy<caf::StandardRecord> * sr) -> std::vector<double>
         {
+            utilities::SpillScope scope(sr);
             std::vector<double> var;
             for(auto const& i : sr->dlp_true)
             {
@@ -189,6 +194,7 @@ ana::SpillMultiVar SpineVar(double (*fvar)(const VARTYPE &), bool (*fcut)(const
     {
         return ana::SpillMultiVar([fvar, fcut, fcat, pident](const caf::Proxy<caf::StandardRecord> * sr) -> std::vector<double>
         {
+            utilities::SpillScope scope(sr);
             std::vector<double> var;
             bool is_mc(sr->ndlp_true != 0);
             for(auto const& i : sr->dlp)
@@ -217,6 +223,7 @@ ana::SpillMultiVar SpineVar(double (*fvar)(const VARTYPE &), bool (*fcut)(const
     {
         return ana::SpillMultiVar([fvar, fcut, fcat, pident](const caf::Proxy<caf::StandardRecord> * sr) -> std::vector<double>
         {
+            utilities::SpillScope scope(sr);
             std::vector<double> var;
             bool is_mc(sr->ndlp_true != 0);
             for(auto const& i : sr->dlp)
@@ -244,6 +251,7 @@ ana::SpillMultiVar SpineVar(double (*fvar)(const VARTYPE &), bool (*fcut)(const
     {
         return ana::SpillMultiVar([fvar, fcut, fcat, pident](const caf::Proxy<caf::StandardRecord> * sr) -> std::vector<double>
         {
+            utilities::SpillScope scope(sr);
             std::vector<double> var;
             for(auto const& i : sr->dlp_true)
             {
@@ -258,10 +266,11 @@ ana::SpillMultiVar SpineVar(double (*fvar)(const VARTYPE &), bool (*fcut)(const
     }
     /**
      * @details This is the case that handles the mapping of an identified true
-     * particle to its corresponding reco particle twin. It is necessary to
-     * first build a map of reco particles by their ID to allow for quick
-     * access to the matched reco particle. Then, the function iterates over
-     * the true interactions, checks that the interaction passes the cut and
+     * particle to its corresponding reco particle twin. The reco particles
+     * are looked up by ID in the spill-scoped @ref utilities::ParticleIndex
+     * (see @ref utilities::matched_reco_particle()), which is built once per
+     * spill and shared by all variables. The function iterates over the true
+     * interactions, checks that the interaction passes the cut and
      * that it is matched to a reco interaction. If these conditions are met,
      * the function retrieves the index of the identified particle and grabs
      * the corresponding matched reco particle from the map, if it exists. The
@@ -272,22 +281,16 @@ ana::SpillMultiVar SpineVar(double (*fvar)(const VARTYPE &), bool (*fcut)(const
     {
         return ana::SpillMultiVar([fvar, fcut, fcat, pident](const caf::Proxy<caf::StandardRecord> * sr) -> std::vector<double>
         {
+            utilities::SpillScope scope(sr);
             std::vector<double> var;
-            std::map<caf::Proxy<int64_t>, const caf::Proxy<caf::SRParticleDLP> *> reco_particles;
-            for(auto const& i : sr->dlp)
-            {
-                for(auto const& j : i.particles)
-                {
-                    reco_particles.insert(std::make_pair(j.id, &j));
-                }
-            }
             for(auto const& i : sr->dlp_true)
             {
                 if(fcut(i) && i.match_ids.size() > 0)
                 {
                     size_t index(pident(i));
-                    if(i.particles[index].match_ids.size() > 0)
-                        var.push_back(fvar(*reco_particles[i.particles[index].match_ids[0]]));
+                    const RTYPEP * p(utilities::matched_reco_particle(sr, i.particles[index]));
+                    if(p != nullptr)
+                        var.push_back(fvar(*p));
                     else var.push_back(-1.0);
                 }
             }
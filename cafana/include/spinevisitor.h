@@ -0,0 +1,267 @@
+/**
+ * @file spinevisitor.h
+ * @brief Header file for the SpineVisitor class, a compile-time registry of
+ * variables that are evaluated in a single traversal of each spill.
+ * @details This file contains the implementation of the SpineVisitor class.
+ * A SpineVisitor is specialized on a typelist of columns, each of which is a
+ * (cut, category, variable) tuple given as template arguments (see
+ * @ref SpineColumn and @ref SpinePColumn). All of the functions are known at
+ * compile time, so the visitor is a single specialized loop over the reco
+ * interactions (and/or the true interactions) of the spill in which the
+ * compiler can inline every cut and variable. Columns that share the same
+ * cut and category share a single evaluation of the selection for each
+ * interaction. This replaces one lambda per variable (e.g. through the
+ * SPINEVAR_RR/RT/TR/TT macros of preprocessor.h), each with its own loop
+ * over the interactions and its own evaluation of the cut, with one loop per
+ * spill shared by all variables.
+ * @author mueller@fnal.gov
+ */
+#ifndef SPINEVISITOR_H
+#define SPINEVISITOR_H
+#include <vector>
+#include <string>
+#include <array>
+#include <map>
+#include <memory>
+#include <tuple>
+#include <utility>
+#include <type_traits>
+
+#include "sbnana/CAFAna/Core/MultiVar.h"
+#include "include/spinevar.h"
+#include "include/spinecolumns.h"
+
+namespace ana
+{
+    /**
+     * @struct SpineColumn
+     * @brief A column of a SpineVisitor: a variable on the selected
+     * interaction (or its matched twin).
+     * @details The type of interaction looped over (reco or true) is the
+     * argument type of the cut, and the variable may be applied to either the
+     * selected interaction or its matched twin. This mirrors the broadcasting
+     * rules of SpineVar<VARTYPE, CUTTYPE>(fvar, fcut, fcat): for reco
+     * interactions, the category cut is applied to the matched true
+     * interaction (except on data), while for true interactions only matched
+     * interactions are considered and the category cut is not used. Variables
+     * on the true interaction receive a value of -1 if the selected reco
+     * interaction is not matched.
+     * @tparam FCUT the cut (e.g. &cuts::muon2024::all_1muNp_cut<RTYPE>).
+     * @tparam FCAT the category cut on the true interaction.
+     * @tparam FVAR the variable (e.g. &vars::phiT<RTYPE>).
+     */
+    template<auto FCUT, auto FCAT, auto FVAR>
+    struct SpineColumn {};
+
+    /**
+     * @struct SpinePColumn
+     * @brief A column of a SpineVisitor: a variable on an identified particle
+     * of the selected interaction (or its matched twin).
+     * @details The particle of interest is identified (by index) on an
+     * interaction of the argument type of PIDENT, and the variable is applied
+     * to that particle or to its matched twin if the argument type of FVAR is
+     * of the other kind. Variables that cannot be evaluated because of a
+     * missing match receive a value of -1.
+     * @tparam FCUT the cut.
+     * @tparam FCAT the category cut on the true interaction.
+     * @tparam FVAR the particle variable (e.g. &pvars::ke<RTYPEP>).
+     * @tparam PIDENT the function identifying the particle of interest (e.g.
+     * &utilities::leading_muon_index<RTYPE>).
+     */
+    template<auto FCUT, auto FCAT, auto FVAR, auto PIDENT>
+    struct SpinePColumn {};
+
+    namespace visitor
+    {
+        using spine::Candidate;
+
+        /**
+         * @struct Selection
+         * @brief Tag type identifying the selection of a column.
+         */
+        template<auto FCUT, auto FCAT>
+        struct Selection {};
+
+        /**
+         * @brief The argument type of a function pointer.
+         */
+        template<class F>
+        struct argument;
+
+        template<class R, class A>
+        struct argument<R (*)(const A &)> { using type = A; };
+
+        template<auto F>
+        using argument_t = typename argument<decltype(F)>::type;
+
+        /**
+         * @struct Traits
+         * @brief The selection and evaluation of a column.
+         */
+        template<class COLUMN>
+        struct Traits;
+
+        template<auto FCUT, auto FCAT, auto FVAR>
+        struct Traits<SpineColumn<FCUT, FCAT, FVAR>>
+        {
+            using cut_type = argument_t<FCUT>;
+            using selection = Selection<FCUT, FCAT>;
+            static bool select(const Candidate & c, bool is_mc) { return spine::select<cut_type>(c, is_mc, FCUT, FCAT); }
+            static double evaluate(const Candidate & c, const caf::Proxy<caf::StandardRecord> *) { return spine::evaluate<argument_t<FVAR>>(c, FVAR); }
+        };
+
+        template<auto FCUT, auto FCAT, auto FVAR, auto PIDENT>
+        struct Traits<SpinePColumn<FCUT, FCAT, FVAR, PIDENT>>
+        {
+            using cut_type = argument_t<FCUT>;
+            using selection = Selection<FCUT, FCAT>;
+            static bool select(const Candidate & c, bool is_mc) { return spine::select<cut_type>(c, is_mc, FCUT, FCAT); }
+            static double evaluate(const Candidate & c, const caf::Proxy<caf::StandardRecord> * sr) { return spine::evaluate<argument_t<FVAR>, argument_t<PIDENT>>(c, sr, FVAR, PIDENT); }
+        };
+    } // namespace visitor
+
+    /**
+     * @class SpineVisitor
+     * @brief Compile-time registry of variables evaluated in a single
+     * traversal of each spill.
+     * @details This class is specialized on a typelist of columns (see
+     * @ref SpineColumn and @ref SpinePColumn). For each spill, the reco
+     * interactions are traversed once if any column selects reco
+     * interactions, and likewise for the true interactions. For each
+     * interaction, the selection of each distinct (cut, category) pair is
+     * evaluated once and the variable of every column passing its selection
+     * is appended to the column. The SpillMultiVars returned by
+     * @ref GetVars() each read their column from a cache that is shared by
+     * all columns, with the same invalidation rules as the SpineTree.
+     * @tparam COLUMNS the columns of the visitor.
+     */
+    template<class... COLUMNS>
+    class SpineVisitor
+    {
+    public:
+        static constexpr size_t ncolumns = sizeof...(COLUMNS);
+
+        /**
+         * @brief Constructor for the SpineVisitor class.
+         */
+        SpineVisitor() : state(std::make_shared<State>()) {}
+
+        /**
+         * @brief Get the SpillMultiVars implementing the columns.
+         * @details The names are given in the order of the columns, and the
+         * number of names is checked at compile time. The map can be passed
+         * directly to @ref Analysis::AddTree().
+         * @param names the names of the columns in the output TTree.
+         * @return the map of variable names and SpillMultiVars.
+         */
+        template<class... NAMES>
+        std::map<std::string, ana::SpillMultiVar> GetVars(const NAMES &... names) const
+        {
+            static_assert(sizeof...(NAMES) == ncolumns, "A name must be given for each column of the SpineVisitor.");
+            std::array<std::string, ncolumns> labels = {std::string(names)...};
+            std::map<std::string, ana::SpillMultiVar> vars;
+            for(size_t c(0); c < ncolumns; ++c)
+            {
+                std::shared_ptr<State> s(state);
+                vars.insert({labels[c], ana::SpillMultiVar([s, c](const caf::Proxy<caf::StandardRecord> * sr) -> std::vector<double>
+                {
+                    return s->Consume(sr, c);
+                })});
+            }
+            return vars;
+        }
+
+    private:
+        using Columns = std::tuple<COLUMNS...>;
+
+        template<size_t I>
+        using traits = visitor::Traits<std::tuple_element_t<I, Columns>>;
+
+        /**
+         * @brief Find the first column sharing the selection of column I.
+         * @return the index of the first column with the same selection.
+         */
+        template<size_t I, size_t J = 0>
+        static constexpr size_t first_selection()
+        {
+            if constexpr(std::is_same_v<typename traits<J>::selection, typename traits<I>::selection>)
+                return J;
+            else
+                return first_selection<I, J + 1>();
+        }
+
+        template<class LOOP, size_t... I>
+        static constexpr bool any_loop(std::index_sequence<I...>)
+        {
+            return (std::is_same_v<typename traits<I>::cut_type, LOOP> || ...);
+        }
+
+        /**
+         * @struct State
+         * @brief The per-spill cache shared by all columns of the visitor.
+         */
+        struct State
+        {
+            spine::ColumnCache cache;
+
+            /**
+             * @brief Evaluate a column on a candidate of the loop LOOP.
+             * @details The selection is evaluated only for the first column
+             * with each distinct selection; later columns reuse the result.
+             * Columns that select the other type of interaction are skipped
+             * at compile time.
+             */
+            template<class LOOP, size_t I>
+            void Visit(const visitor::Candidate & c, bool is_mc, const caf::Proxy<caf::StandardRecord> * sr, std::array<bool, ncolumns> & pass)
+            {
+                if constexpr(std::is_same_v<typename traits<I>::cut_type, LOOP>)
+                {
+                    constexpr size_t s(first_selection<I>());
+                    if constexpr(s == I)
+                        pass[I] = traits<I>::select(c, is_mc);
+                    else
+                        pass[I] = pass[s];
+                    if(pass[I])
+                        cache.Column(I).push_back(traits<I>::evaluate(c, sr));
+                }
+            }
+
+            template<class LOOP, size_t... I>
+            void VisitAll(const visitor::Candidate & c, bool is_mc, const caf::Proxy<caf::StandardRecord> * sr, std::index_sequence<I...>)
+            {
+                std::array<bool, ncolumns> pass{};
+                (Visit<LOOP, I>(c, is_mc, sr, pass), ...);
+            }
+
+            /**
+             * @brief Evaluate all columns for a spill.
+             * @param sr the StandardRecord proxy of the spill.
+             * @return void
+             */
+            void Fill(const caf::Proxy<caf::StandardRecord> * sr)
+            {
+                constexpr auto columns = std::index_sequence_for<COLUMNS...>();
+                if constexpr(any_loop<RTYPE>(columns))
+                    spine::for_each_candidate<RTYPE>(sr, [&](const visitor::Candidate & c, bool is_mc) { VisitAll<RTYPE>(c, is_mc, sr, columns); });
+                if constexpr(any_loop<TTYPE>(columns))
+                    spine::for_each_candidate<TTYPE>(sr, [&](const visitor::Candidate & c, bool is_mc) { VisitAll<TTYPE>(c, is_mc, sr, columns); });
+            }
+
+            /**
+             * @brief Hand out a column of the cache for a spill.
+             * @details The cache is refilled if the spill has changed (see
+             * @ref spine::ColumnCache).
+             * @param sr the StandardRecord proxy of the spill.
+             * @param c the index of the column.
+             * @return the column of variable values.
+             */
+            std::vector<double> Consume(const caf::Proxy<caf::StandardRecord> * sr, size_t c)
+            {
+                return cache.Consume(sr, c, ncolumns, [this](const caf::Proxy<caf::StandardRecord> * r) { Fill(r); });
+            }
+        };
+
+        std::shared_ptr<State> state;
+    };
+} // namespace ana
+#endif // SPINEVISITOR_H
@@ -13,10 +13,28 @@
 #define UTILITIES_H
 
 #include <vector>
+#include <unordered_map>
 
+#include "sbnanaobj/StandardRecord/Proxy/SRProxy.h"
 #include "include/particle_variables.h"
 #include "include/particle_cuts.h"
 
+/**
+ * @brief Linkage of the per-spill singletons.
+ * @details The thread-local state of the @ref utilities::SpillCache and of
+ * the reco particle index must exist exactly once per thread. When the
+ * cafana shared library is built or loaded (see cafana.h), the functions
+ * holding the state are only declared here and are defined once, out of
+ * line, in src/cafana.cc (which defines CAFANA_DEFINE_SINGLETONS). Otherwise
+ * the headers are used on their own and the functions are defined inline.
+ */
+#if defined(CAFANA_LIBRARY) || defined(CAFANA_BUILD_LIBRARY)
+#define CAFANA_SINGLETON
+#else
+#define CAFANA_SINGLETON inline
+#define CAFANA_DEFINE_SINGLETONS
+#endif
+
 /**
  * @namespace utilities
  * @brief Namespace for organizing utility functions for supporting analysis
@@ -33,27 +51,165 @@
 namespace utilities
 {
     /**
-     * @brief Count the primaries of the interaction with cuts applied to each particle.
+     * @class PrimaryCounts
+     * @brief Packed counts of the primaries of each particle type.
+     * @details The counts of the five particle types (photons, electrons,
+     * muons, pions, protons, in PID order) are packed into 12-bit lanes of a
+     * single 64-bit integer. The top bit of each lane is a guard bit that is
+     * always zero, leaving 11 bits for the count, which saturates at 2047.
+     * The guard bits allow all five counts to be checked against a
+     * @ref Topology at once with a handful of integer operations.
+     */
+    class PrimaryCounts
+    {
+    public:
+        static constexpr size_t nlanes = 5;
+        static constexpr uint32_t lane_bits = 12;
+        static constexpr uint64_t lane_max = (uint64_t(1) << (lane_bits - 1)) - 1;
+
+        /**
+         * @brief Get the mask of the guard bits of all lanes.
+         * @return the mask of the guard bits.
+         */
+        static constexpr uint64_t guard_mask()
+        {
+            uint64_t mask(0);
+            for(size_t i(0); i < nlanes; ++i)
+                mask |= uint64_t(1) << (i * lane_bits + lane_bits - 1);
+            return mask;
+        }
+
+        /**
+         * @brief Construct a set of counts (all zero by default).
+         * @param packed the packed representation of the counts.
+         */
+        constexpr explicit PrimaryCounts(uint64_t packed = 0) : packed(packed) {}
+
+        /**
+         * @brief Increment the count of a particle type.
+         * @param pid the particle type.
+         * @return void
+         */
+        constexpr void increment(size_t pid)
+        {
+            if((*this)[pid] < lane_max)
+                packed += uint64_t(1) << (pid * lane_bits);
+        }
+
+        /**
+         * @brief Get the count of a particle type.
+         * @param pid the particle type.
+         * @return the count of the particle type.
+         */
+        constexpr uint32_t operator[](size_t pid) const { return (packed >> (pid * lane_bits)) & lane_max; }
+
+        /**
+         * @brief Get the packed representation of the counts.
+         * @return the packed counts.
+         */
+        constexpr uint64_t value() const { return packed; }
+
+    private:
+        uint64_t packed;
+    };
+
+    /**
+     * @class Topology
+     * @brief Compile-time definition of a final state topology.
+     * @details A topology is an inclusive range [lo, hi] on the count of each
+     * particle type. The ranges are stored as packed lower and upper bounds
+     * in the same layout as @ref PrimaryCounts, so a topology is matched in a
+     * single branchless step: with the guard bits G set, (c | G) - L keeps
+     * the guard bit of a lane iff c >= lo, and (H | G) - c keeps it iff
+     * c <= hi. No lane can borrow from its neighbor because the guard bit
+     * exceeds every count and bound. Topologies are built with the constexpr
+     * modifiers, which default to "any count" for unspecified types, e.g.
+     * Topology().exactly(2, 1).at_least(4, 1).
+     */
+    class Topology
+    {
+    public:
+        /**
+         * @brief Construct a topology that accepts any counts.
+         */
+        constexpr Topology() : lo(0), hi(0)
+        {
+            for(size_t i(0); i < PrimaryCounts::nlanes; ++i)
+                hi |= PrimaryCounts::lane_max << (i * PrimaryCounts::lane_bits);
+        }
+
+        /**
+         * @brief Require a count within [n, m] for a particle type.
+         * @param pid the particle type.
+         * @param n the minimum count.
+         * @param m the maximum count.
+         * @return the modified topology.
+         */
+        constexpr Topology between(size_t pid, uint32_t n, uint32_t m) const
+        {
+            Topology t(*this);
+            uint32_t shift(pid * PrimaryCounts::lane_bits);
+            uint64_t clear(~(PrimaryCounts::lane_max << shift));
+            t.lo = (t.lo & clear) | (uint64_t(n) << shift);
+            t.hi = (t.hi & clear) | (uint64_t(m < PrimaryCounts::lane_max ? m : PrimaryCounts::lane_max) << shift);
+            return t;
+        }
+
+        /**
+         * @brief Require exactly n of a particle type.
+         * @param pid the particle type.
+         * @param n the count.
+         * @return the modified topology.
+         */
+        constexpr Topology exactly(size_t pid, uint32_t n) const { return between(pid, n, n); }
+
+        /**
+         * @brief Require at least n of a particle type.
+         * @param pid the particle type.
+         * @param n the minimum count.
+         * @return the modified topology.
+         */
+        constexpr Topology at_least(size_t pid, uint32_t n) const { return between(pid, n, PrimaryCounts::lane_max); }
+
+        /**
+         * @brief Check if a set of counts matches the topology.
+         * @param c the counts of the primaries.
+         * @return true if every count lies within its range.
+         */
+        constexpr bool matches(const PrimaryCounts & c) const
+        {
+            constexpr uint64_t g(PrimaryCounts::guard_mask());
+            return (((c.value() | g) - lo) & ((hi | g) - c.value()) & g) == g;
+        }
+
+    private:
+        uint64_t lo;
+        uint64_t hi;
+    };
+
+    /**
+     * @brief Count the primaries of the interaction with cuts applied to each
+     * particle (uncached).
      * @tparam T the type of interaction (true or reco).
      * @param obj the interaction to find the topology of.
      * @return the count of primaries of each particle type within the
      * interaction.
      */
     template<class T>
-        std::vector<uint32_t> count_primaries(const T & obj)
+        PrimaryCounts compute_primaries(const T & obj)
         {
-            std::vector<uint32_t> counts(5, 0);
+            PrimaryCounts counts;
             for(auto &p : obj.particles)
             {
                 if(pcuts::final_state_signal(p))
-                    ++counts[p.pid];
+                    counts.increment(p.pid);
             }
             return counts;
         }
-    
+
     /**
-     * @brief Finds the index corresponding to the leading particle of the specifed
-     * particle type.
+     * @brief Finds the index corresponding to the leading particle of the
+     * specifed particle type (uncached).
      * @details The leading particle is defined as the particle with the highest
      * kinetic energy. If the interaction is a true interaction, the initial kinetic
      * energy is used instead of the CSDA kinetic energy.
@@ -63,7 +219,7 @@ namespace utilities
      * @return the index of the leading particle (highest KE). 
      */
     template <class T>
-        size_t leading_particle_index(const T & obj, uint16_t pid)
+        size_t compute_leading_particle_index(const T & obj, uint16_t pid)
         {
             double leading_ke(0);
             size_t index(0);
@@ -82,6 +238,318 @@ namespace utilities
             return index;
         }
 
+    /**
+     * @struct InteractionSummary
+     * @brief Per-interaction quantities that are used by many variables and
+     * cuts.
+     * @details The summary holds the primary counts (see
+     * @ref compute_primaries()) and the indices of the leading muon and leading
+     * proton (see @ref compute_leading_particle_index()).
+     */
+    struct InteractionSummary
+    {
+        PrimaryCounts counts;
+        size_t leading_muon;
+        size_t leading_proton;
+    };
+
+    /**
+     * @class SpillCache
+     * @brief Bookkeeping for the per-spill cache of interaction summaries.
+     * @details The interaction summaries are cached by interaction id, which
+     * is only unique within a single spill. This class tracks the spill that
+     * the cache refers to through a generation counter: entering a
+     * @ref SpillScope for a different spill (or explicitly invalidating the
+     * cache) starts a new generation, and cached summaries from an earlier
+     * generation are discarded. Outside of any SpillScope, no caching is
+     * done. The bookkeeping is thread-local.
+     */
+    class SpillCache
+    {
+    public:
+        /**
+         * @brief Get the (thread-local) instance of the SpillCache.
+         * @return the SpillCache instance.
+         */
+        static SpillCache & instance();
+
+        /**
+         * @brief Enter a scope for the specified spill.
+         * @details A new generation is started if the spill differs from the
+         * spill of the current generation. CAFAna reuses a single proxy for
+         * every spill, so a caller that knows that the spill has changed
+         * although the header is the same forces a new generation.
+         * @param sr the StandardRecord proxy of the spill.
+         * @param fresh whether the spill is known to be a new spill.
+         * @return void
+         */
+        void enter(const caf::Proxy<caf::StandardRecord> * sr, bool fresh = false)
+        {
+            if(fresh || !valid || sr != record || run != sr->hdr.run || subrun != sr->hdr.subrun || evt != sr->hdr.evt)
+            {
+                ++current;
+                record = sr;
+                run = sr->hdr.run;
+                subrun = sr->hdr.subrun;
+                evt = sr->hdr.evt;
+                valid = true;
+            }
+            ++depth;
+        }
+
+        /**
+         * @brief Leave a scope.
+         * @return void
+         */
+        void exit() { --depth; }
+
+        /**
+         * @brief Discard all cached summaries.
+         * @details This should be called whenever the records of a previous
+         * spill may be reused with the same header (e.g. between samples).
+         * @return void
+         */
+        void invalidate() { ++current; valid = false; }
+
+        /**
+         * @brief Check if caching is enabled (inside a SpillScope).
+         * @return true if the cache is active.
+         */
+        bool active() const { return depth > 0; }
+
+        /**
+         * @brief Get the current generation.
+         * @return the current generation.
+         */
+        uint64_t generation() const { return current; }
+
+    private:
+        SpillCache() = default;
+        uint64_t current = 1;
+        size_t depth = 0;
+        bool valid = false;
+        const caf::Proxy<caf::StandardRecord> * record = nullptr;
+        unsigned run = 0, subrun = 0, evt = 0;
+    };
+
+#ifdef CAFANA_DEFINE_SINGLETONS
+    CAFANA_SINGLETON SpillCache & SpillCache::instance()
+    {
+        static thread_local SpillCache cache;
+        return cache;
+    }
+#endif
+
+    /**
+     * @class SpillScope
+     * @brief RAII guard that enables the interaction summary cache for a
+     * single spill.
+     * @details The interaction summaries requested while a SpillScope is alive
+     * are cached and reused by every variable and cut evaluated on the same
+     * spill. Scopes may be nested.
+     */
+    class SpillScope
+    {
+    public:
+        /**
+         * @brief Enter the scope of a spill.
+         * @param sr the StandardRecord proxy of the spill.
+         * @param fresh whether the spill is known to be a new spill (see
+         * @ref SpillCache::enter()).
+         */
+        SpillScope(const caf::Proxy<caf::StandardRecord> * sr, bool fresh = false) { SpillCache::instance().enter(sr, fresh); }
+
+        /**
+         * @brief Leave the scope of the spill.
+         */
+        ~SpillScope() { SpillCache::instance().exit(); }
+
+        SpillScope(const SpillScope &) = delete;
+        SpillScope & operator=(const SpillScope &) = delete;
+    };
+
+    /**
+     * @class ParticleIndex
+     * @brief Dense index of the reco particles of a spill by particle id.
+     * @details Particle ids are small integers assigned sequentially within a
+     * spill, so the index is a vector of pointers addressed directly by id. A
+     * lookup is a single bounds check and load. Ids that are negative or far
+     * beyond the number of particles in the spill (which are not expected)
+     * are stored in a small overflow map instead of growing the vector.
+     */
+    class ParticleIndex
+    {
+    public:
+        /**
+         * @brief Rebuild the index for the specified spill.
+         * @details The storage of the index is reused between spills.
+         * @param sr the StandardRecord proxy of the spill.
+         * @return void
+         */
+        void build(const caf::Proxy<caf::StandardRecord> * sr)
+        {
+            size_t n(0);
+            for(auto const & i : sr->dlp)
+                n += i.particles.size();
+
+            dense.assign(n, nullptr);
+            overflow.clear();
+            for(auto const & i : sr->dlp)
+            {
+                for(auto const & j : i.particles)
+                {
+                    int64_t id(j.id);
+                    if(id < 0 || size_t(id) >= 4 * n + 64)
+                        overflow.emplace(id, &j);
+                    else
+                    {
+                        if(size_t(id) >= dense.size())
+                            dense.resize(id + 1, nullptr);
+                        if(dense[id] == nullptr)
+                            dense[id] = &j;
+                    }
+                }
+            }
+        }
+
+        /**
+         * @brief Find a reco particle by its id.
+         * @param id the id of the particle.
+         * @return a pointer to the particle, or nullptr if no particle in the
+         * spill has the specified id.
+         */
+        const caf::SRParticleDLPProxy * find(int64_t id) const
+        {
+            if(id >= 0 && size_t(id) < dense.size())
+                return dense[id];
+            auto it = overflow.find(id);
+            return it != overflow.end() ? it->second : nullptr;
+        }
+
+    private:
+        std::vector<const caf::SRParticleDLPProxy *> dense;
+        std::unordered_map<int64_t, const caf::SRParticleDLPProxy *> overflow;
+    };
+
+    /**
+     * @brief Get the index of the reco particles of a spill by particle id.
+     * @details Inside a @ref SpillScope, the index is built once per spill and
+     * shared by every variable evaluated on the spill. Outside of a
+     * SpillScope, the index is rebuilt on every call (reusing its storage).
+     * The reference remains valid until the index is next rebuilt, so it
+     * should not be held across spills.
+     * @param sr the StandardRecord proxy of the spill.
+     * @return the index of the reco particles.
+     */
+    CAFANA_SINGLETON const ParticleIndex & reco_particle_index(const caf::Proxy<caf::StandardRecord> * sr);
+
+#ifdef CAFANA_DEFINE_SINGLETONS
+    CAFANA_SINGLETON const ParticleIndex & reco_particle_index(const caf::Proxy<caf::StandardRecord> * sr)
+    {
+        static thread_local uint64_t generation(0);
+        static thread_local ParticleIndex index;
+
+        SpillCache & spill(SpillCache::instance());
+        if(!spill.active() || generation != spill.generation())
+        {
+            index.build(sr);
+            generation = spill.active() ? spill.generation() : 0;
+        }
+        return index;
+    }
+#endif
+
+    /**
+     * @brief Get the reco particle matched to a true particle.
+     * @details The reco particle is looked up by id in the index of the reco
+     * particles of the spill (see @ref reco_particle_index()).
+     * @param sr the StandardRecord proxy of the spill.
+     * @param p the true particle.
+     * @return the matched reco particle, or nullptr if there is none.
+     */
+    inline const caf::SRParticleDLPProxy * matched_reco_particle(const caf::Proxy<caf::StandardRecord> * sr, const caf::SRParticleTruthDLPProxy & p)
+    {
+        return p.match_ids.size() > 0 ? reco_particle_index(sr).find(p.match_ids[0]) : nullptr;
+    }
+
+    /**
+     * @brief Get the summary of an interaction.
+     * @details Inside a @ref SpillScope, the summary is computed once per
+     * interaction (keyed by the interaction id) and cached for the remainder
+     * of the spill. Outside of a SpillScope, the summary is computed on every
+     * call. The cache is a thread-local of each instantiation, so the
+     * instantiations for the proxy types are provided by the cafana shared
+     * library (see instantiations.h) to keep a single cache per thread.
+     * @tparam T the type of interaction (true or reco).
+     * @param obj the interaction to summarize.
+     * @return the summary of the interaction.
+     */
+    template<class T>
+        const InteractionSummary & interaction_summary(const T & obj)
+        {
+            static thread_local uint64_t generation(0);
+            static thread_local std::unordered_map<int64_t, InteractionSummary> cache;
+            static thread_local InteractionSummary scratch;
+
+            SpillCache & spill(SpillCache::instance());
+            if(!spill.active())
+            {
+                scratch = {compute_primaries(obj), compute_leading_particle_index(obj, 2), compute_leading_particle_index(obj, 4)};
+                return scratch;
+            }
+            if(generation != spill.generation())
+            {
+                cache.clear();
+                generation = spill.generation();
+            }
+            auto it = cache.find(obj.id);
+            if(it == cache.end())
+                it = cache.emplace(int64_t(obj.id), InteractionSummary{compute_primaries(obj), compute_leading_particle_index(obj, 2), compute_leading_particle_index(obj, 4)}).first;
+            return it->second;
+        }
+
+    /**
+     * @brief Count the primaries of the interaction with cuts applied to each particle.
+     * @details Inside a @ref SpillScope, the counts are taken from the
+     * (cached) @ref interaction_summary().
+     * @tparam T the type of interaction (true or reco).
+     * @param obj the interaction to find the topology of.
+     * @return the count of primaries of each particle type within the
+     * interaction.
+     */
+    template<class T>
+        PrimaryCounts count_primaries(const T & obj)
+        {
+            if(!SpillCache::instance().active())
+                return compute_primaries(obj);
+            return interaction_summary(obj).counts;
+        }
+    
+    /**
+     * @brief Finds the index corresponding to the leading particle of the specifed
+     * particle type.
+     * @details The leading particle is defined as the particle with the highest
+     * kinetic energy. If the interaction is a true interaction, the initial kinetic
+     * energy is used instead of the CSDA kinetic energy. Inside a
+     * @ref SpillScope, the leading muon and leading proton are taken from the
+     * (cached) @ref interaction_summary().
+     * @tparam T the type of interaction (true or reco).
+     * @param obj the interaction to operate on.
+     * @param pid of the particle type.
+     * @return the index of the leading particle (highest KE). 
+     */
+    template <class T>
+        size_t leading_particle_index(const T & obj, uint16_t pid)
+        {
+            if(!SpillCache::instance().active())
+                return compute_leading_particle_index(obj, pid);
+            if(pid == 2)
+                return interaction_summary(obj).leading_muon;
+            if(pid == 4)
+                return interaction_summary(obj).leading_proton;
+            return compute_leading_particle_index(obj, pid);
+        }
+
     /**
      * @brief Finds the index corresponding to the leading muon.
      * @details The leading muon is defined as the muon with the highest
@@ -49,7 +49,7 @@ namespace vars
      * @param obj the interaction to apply the variable on.
      * @return the neutrino ID.
      */
-    double neutrino_id(const caf::SRInteractionTruthDLPProxy & obj) { return obj.nu_id; }
+    inline double neutrino_id(const caf::SRInteractionTruthDLPProxy & obj) { return obj.nu_id; }
 
     /**
      * @brief Variable for a basic enumeration of interaction categories by
@@ -59,7 +59,7 @@ namespace vars
      * @param obj the interaction to apply the variable on.
      * @return the interaction category.
      */
-    double neutrino_interaction_mode(const caf::SRInteractionTruthDLPProxy & obj)
+    inline double neutrino_interaction_mode(const caf::SRInteractionTruthDLPProxy & obj)
     {
         double cat(-1);
         if(cuts::neutrino(obj))
@@ -401,7 +401,7 @@ namespace vars
             size_t i(utilities::leading_particle_index(obj, 2));
             double energy(pvars::energy(obj.particles[i]));
             if constexpr (std::is_same_v<T, caf::SRInteractionTruthDLPProxy>)
-                energy = pvars::ke_init(obj.particles[i]);
+                energy = pvars::ke(obj.particles[i]);
             return energy;
         }
 
@@ -420,7 +420,7 @@ namespace vars
             size_t i(utilities::leading_particle_index(obj, 4));
             double energy(pvars::energy(obj.particles[i]));
             if constexpr (std::is_same_v<T, caf::SRInteractionTruthDLPProxy>)
-                energy = pvars::ke_init(obj.particles[i]);
+                energy = pvars::ke(obj.particles[i]);
             return energy;
         }
     
@@ -0,0 +1,24 @@
+/**
+ * @file cafana.cc
+ * @brief Explicit instantiations of the cafana cuts, variables, and utility
+ * functions for the CAF proxy types.
+ * @details This file is compiled into the cafana shared library. It emits an
+ * optimized definition of each of the templates listed in instantiations.h
+ * for the proxy types they support. Macros that include cafana.h load the
+ * library and use these definitions rather than instantiating the templates
+ * in the interpreter. It also holds the single (out-of-line) definition of
+ * the per-spill singletons declared in utilities.h.
+ * @author mueller@fnal.gov
+ */
+#ifndef CAFANA_BUILD_LIBRARY
+#define CAFANA_BUILD_LIBRARY
+#endif
+#define CAFANA_DEFINE_SINGLETONS
+#include "include/cafana.h"
+
+/**
+ * @brief Emit the explicit instantiation of a template for a proxy type.
+ */
+#define CAFANA_INSTANTIATE_TEMPLATE(RETURN, NAME, T) template RETURN NAME<T>(const T &);
+CAFANA_ALL_TEMPLATES(CAFANA_INSTANTIATE_TEMPLATE)
+#undef CAFANA_INSTANTIATE_TEMPLATE
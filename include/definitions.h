@@ -8,10 +8,141 @@
 
 #include <vector>
 #include <map>
+#include <unordered_map>
 
 #include "sbnana/CAFAna/Core/MultiVar.h"
 #include "sbnanaobj/StandardRecord/Proxy/SRProxy.h"
 
+/**
+ * Dense index of the reco particles of a spill by particle id. Particle ids
+ * are small integers assigned sequentially within a spill, so the index is a
+ * vector of pointers addressed directly by id. Ids that are negative or far
+ * beyond the number of particles in the spill (which are not expected) are
+ * stored in a small overflow map instead of growing the vector. This mirrors
+ * utilities::ParticleIndex of cafana, which these macros cannot include.
+*/
+class RecoParticleIndex
+{
+public:
+    /**
+     * Rebuild the index for the specified spill. The storage of the index is
+     * reused between spills.
+     * @param sr the top-level StandardRecord of the spill.
+    */
+    void build(const caf::SRSpillProxy* sr)
+    {
+        size_t n(0);
+        for(auto const& i : sr->dlp)
+            n += i.particles.size();
+
+        dense.assign(n, nullptr);
+        overflow.clear();
+        for(auto const& i : sr->dlp)
+        {
+            for(auto const& p : i.particles)
+            {
+                int64_t id(p.id);
+                if(id < 0 || size_t(id) >= 4 * n + 64)
+                    overflow.emplace(id, &p);
+                else
+                {
+                    if(size_t(id) >= dense.size())
+                        dense.resize(id + 1, nullptr);
+                    if(dense[id] == nullptr)
+                        dense[id] = &p;
+                }
+            }
+        }
+    }
+
+    /**
+     * Find a reco particle by its id.
+     * @param id the id of the particle.
+     * @return a pointer to the particle, or nullptr if it does not exist.
+    */
+    const caf::Proxy<caf::SRParticleDLP> * find(int64_t id) const
+    {
+        if(id >= 0 && size_t(id) < dense.size())
+            return dense[id];
+        auto it = overflow.find(id);
+        return it != overflow.end() ? it->second : nullptr;
+    }
+
+private:
+    std::vector<const caf::Proxy<caf::SRParticleDLP> *> dense;
+    std::unordered_map<int64_t, const caf::Proxy<caf::SRParticleDLP> *> overflow;
+};
+
+/**
+ * Thread-local state of the reco particle index returned by
+ * reco_particle_index(): the index and the spill (record and header) that it
+ * was built for.
+*/
+struct RecoParticleIndexState
+{
+    const caf::SRSpillProxy* record = nullptr;
+    unsigned run = 0, subrun = 0, evt = 0;
+    size_t ninteractions = 0;
+    RecoParticleIndex index;
+};
+
+/**
+ * Get the thread-local state of the reco particle index.
+ * @return the state of the index.
+*/
+inline RecoParticleIndexState & reco_particle_index_state()
+{
+    static thread_local RecoParticleIndexState state;
+    return state;
+}
+
+/**
+ * Discard the cached reco particle index. This should be called whenever the
+ * record of a previous spill may be reused with the same header (e.g.
+ * between samples), as the index is otherwise only rebuilt when the record
+ * or its header changes.
+*/
+inline void invalidate_reco_particle_index()
+{
+    reco_particle_index_state().record = nullptr;
+}
+
+/**
+ * Get the index of the reco particles of a spill by particle id. The index
+ * is built at most once per spill (identified by the record and its header)
+ * and is shared by every variable evaluated on that spill, including
+ * user-written ones. The reference remains valid until the index is next
+ * rebuilt, so it should not be held across spills.
+ * @param sr the top-level StandardRecord of the spill.
+ * @return the index of reco particles.
+*/
+inline const RecoParticleIndex & reco_particle_index(const caf::SRSpillProxy* sr)
+{
+    RecoParticleIndexState & s(reco_particle_index_state());
+    if(sr != s.record || s.run != sr->hdr.run || s.subrun != sr->hdr.subrun || s.evt != sr->hdr.evt || s.ninteractions != sr->dlp.size())
+    {
+        s.record = sr;
+        s.run = sr->hdr.run;
+        s.subrun = sr->hdr.subrun;
+        s.evt = sr->hdr.evt;
+        s.ninteractions = sr->dlp.size();
+        s.index.build(sr);
+    }
+    return s.index;
+}
+
+/**
+ * Look up a reco particle by id in the index returned by
+ * reco_particle_index().
+ * @param index the index of reco particles.
+ * @param id the id of the particle.
+ * @return a pointer to the particle, or nullptr if it does not exist.
+*/
+inline const caf::Proxy<caf::SRParticleDLP> * find_reco_particle(const RecoParticleIndex & index, int64_t id)
+{
+    return index.find(id);
+}
+
 /**
  * Preprocessor wrapper for looping over reco interactions. The SpillMultiVar
  * accepts a vector as a result of some function running over the top-level
@@ -155,18 +286,14 @@
     const SpillMultiVar NAME([](const caf::SRSpillProxy* sr)                                     \
     {                                                                                            \
         std::vector<double> var;                                                                 \
-        std::map<caf::Proxy<int64_t>, const caf::Proxy<caf::SRParticleDLP> *> reco_particles;    \
-        for(auto const& i : sr->dlp)                                                             \
-        {                                                                                        \
-            for(auto const& p : i.particles)                                                     \
-                reco_particles.insert(std::make_pair(p.id, &p));                                 \
-        }                                                                                        \
+        auto const& reco_particles(reco_particle_index(sr));                                     \
         for(auto const& i : sr->dlp_true)                                                        \
         {                                                                                        \
             for(auto const& p : i.particles)                                                     \
             {                                                                                    \
-                if(ICAT(i) && PCAT(p) && p.match.size() > 0 && SEL(*reco_particles[p.match[0]])) \
-                    var.push_back((RVAR(*reco_particles[p.match[0]]) - TVAR(p)) / TVAR(p));      \
+                auto r(p.match.size() > 0 ? find_reco_particle(reco_particles, p.match[0]) : nullptr); \
+                if(ICAT(i) && PCAT(p) && r != nullptr && SEL(*r))                                \
+                    var.push_back((RVAR(*r) - TVAR(p)) / TVAR(p));                               \
             }                                                                                    \
         }                                                                                        \
         return var;                                                                              \
@@ -243,18 +370,14 @@
     const SpillMultiVar NAME([](const caf::SRSpillProxy* sr)                                     \
     {                                                                                            \
         std::vector<double> var;                                                                 \
-        std::map<caf::Proxy<int64_t>, const caf::Proxy<caf::SRParticleDLP> *> reco_particles;    \
-        for(auto const& i : sr->dlp)                                                             \
-        {                                                                                        \
-            for(auto const& p : i.particles)                                                     \
-                reco_particles.insert(std::make_pair(p.id, &p));                                 \
-        }                                                                                        \
+        auto const& reco_particles(reco_particle_index(sr));                                     \
         for(auto const& i : sr->dlp_true)                                                        \
         {                                                                                        \
             for(auto const& p : i.particles)                                                     \
             {                                                                                    \
-                if(ICAT(i) && PCAT(p) && p.match.size() > 0 && SEL(*reco_particles[p.match[0]])) \
-                    var.push_back(VAR(*reco_particles[p.match[0]]));                             \
+                auto r(p.match.size() > 0 ? find_reco_particle(reco_particles, p.match[0]) : nullptr); \
+                if(ICAT(i) && PCAT(p) && r != nullptr && SEL(*r))                                \
+                    var.push_back(VAR(*r));                                                      \
             }                                                                                    \
         }                                                                                        \
         return var;                                                                              \
@@ -1,5 +1,8 @@
+import os
+import multiprocessing
 import toml
 import uproot
+from columnar import ColumnarDirectory
 from sample import Sample
 from spinespectra import SpineSpectra1D, SpineSpectra2D
 from style import Style
@@ -9,6 +12,27 @@ from matplotlib import pyplot as plt
 class ConfigException(Exception):
     pass
 
+# The Analysis being run by the worker processes of Analysis.run(). The
+# workers are forked, so they inherit the loaded samples (and their
+# column caches) without pickling them.
+_active_analysis = None
+
+def _run_spectrum(name) -> None:
+    """
+    Fills and plots a single spectrum of the active Analysis. This is
+    the task executed by the worker processes of Analysis.run().
+
+    Parameters
+    ----------
+    name : str
+        The name of the spectrum.
+
+    Returns
+    -------
+    None.
+    """
+    _active_analysis.run_spectrum(name)
+
 class Analysis:
     """
     The Analysis class is used to containerize the plotting of the
@@ -35,7 +59,9 @@ class Analysis:
         toml_path : str
             The path to the TOML configuration file for the analysis.
         rf_path : str
-            The path to the ROOT file containing the data.
+            The path to the ROOT file containing the data, or to a
+            directory of columnar files converted from it (see
+            `columnar.py`).
 
         Returns
         -------
@@ -45,7 +71,7 @@ class Analysis:
         self._config = toml.load(self._toml_path)
         for table in self._config['this_includes']:
             Analysis.handle_include(self._config, table)
-        rf = uproot.open(rf_path)
+        rf = ColumnarDirectory(rf_path) if os.path.isdir(rf_path) else uproot.open(rf_path)
 
         # Load the categories table
         self._categories = dict()
@@ -57,7 +83,13 @@ class Analysis:
         # Initialize the samples
         if 'samples' not in self._config.keys():
             raise ConfigException(f"No samples defined in the TOML file. Please check for a valid sample configuration block in the TOML file ('{toml_path}').")
-        self._samples = {name: Sample(name, rf, self._config['analysis']['category_branch'], **self._config['samples'][name]) for name in self._config['samples']}
+        # Only the branches used by the configured plots are loaded.
+        key = lambda x : self._config.get('variables', {}).get(x, {}).get('key')
+        columns = {self._config['analysis']['category_branch']}
+        columns.update(key(v['variable']) for v in self._config.get('spectra1D', {}).values())
+        columns.update(key(x) for v in self._config.get('spectra2D', {}).values() for x in v['variables'])
+        columns.discard(None)
+        self._samples = {name: Sample(name, rf, self._config['analysis']['category_branch'], columns=sorted(columns), cache=self._config['analysis'].get('column_cache', False), **self._config['samples'][name]) for name in self._config['samples']}
 
         # Load the plot styles table
         if 'styles' not in self._config.keys():
@@ -104,9 +136,42 @@ class Analysis:
             raise ConfigException(f"Sample '{sample_name}' not found in sample list when attempting to override exposure. Please check the sample configuration block in the TOML file ('{self._toml_path}').")
         self._samples[sample_name].override_exposure(exposure, exposure_type)
 
-    def run(self) -> None:
+    def run_spectrum(self, name) -> None:
+        """
+        Fills a single spectrum with all samples and plots it.
+
+        Parameters
+        ----------
+        name : str
+            The name of the spectrum.
+
+        Returns
+        -------
+        None.
         """
-        Runs the analysis on the samples.
+        s = self._spectra[name]
+        for sample in self._samples.values():
+            s.add_sample(sample)
+
+        with self._styles[s._style] as style:
+            s.plot(style, name)
+            if type(s) == SpineSpectra2D:
+                s.plot_diagonal_reduction(style, name)
+        plt.close('all')
+
+    def run(self, processes=1) -> None:
+        """
+        Runs the analysis on the samples. The spectra are independent,
+        so they may be filled and plotted in a pool of worker processes.
+        The workers are forked from this process and share the loaded
+        samples. All branches used by the spectra are loaded before the
+        pool is started, so the workers never read the input.
+
+        Parameters
+        ----------
+        processes : int
+            The number of worker processes. If 1, the spectra are
+            produced in this process.
 
         Returns
         -------
@@ -118,14 +183,24 @@ class Analysis:
         for s in self._samples.values():
             s.set_weight(target=ordinate)
 
-        for name, s in self._spectra.items():
+        if processes <= 1 or len(self._spectra) <= 1:
+            for name in self._spectra.keys():
+                self.run_spectrum(name)
             for sample in self._samples.values():
-                s.add_sample(sample)
-
-            with self._styles[s._style] as style:
-                s.plot(style, name)
-                if type(s) == SpineSpectra2D:
-                    s.plot_diagonal_reduction(style, name)
+                sample.flush()
+            return
+
+        global _active_analysis
+        columns = [v._key for s in self._spectra.values() for v in s._variables]
+        for sample in self._samples.values():
+            sample.load(columns)
+            sample.flush()
+        _active_analysis = self
+        try:
+            with multiprocessing.get_context('fork').Pool(processes) as pool:
+                pool.map(_run_spectrum, list(self._spectra.keys()), chunksize=1)
+        finally:
+            _active_analysis = None
 
     @classmethod
     def handle_include(self, config, table):
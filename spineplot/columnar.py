@@ -0,0 +1,217 @@
+import os
+import toml
+import uproot
+import numpy as np
+import pandas as pd
+from argparse import ArgumentParser
+
+FORMATS = {'parquet': 'parquet', 'feather': 'feather'}
+
+class ColumnarDirectory:
+    """
+    A class designed to provide access to the contents of an analysis
+    ROOT file that has been converted to a columnar (Parquet or Arrow
+    IPC/Feather) layout by the `convert()` function. The layout mirrors
+    the `events/<sample>/` structure of the ROOT file: each TTree is
+    stored as `<path>/<sample>/<tree>.<ext>` and the exposure of the
+    sample is stored in `<path>/<sample>/exposure.toml`.
+
+    Attributes
+    ----------
+    _path : str
+        The path to the top-level directory of the columnar files.
+    """
+    def __init__(self, path) -> None:
+        """
+        Initializes the ColumnarDirectory object with the given path.
+
+        Parameters
+        ----------
+        path : str
+            The path to the top-level directory of the columnar files.
+
+        Returns
+        -------
+        None.
+        """
+        self._path = path
+
+    def get_exposure(self, key) -> tuple:
+        """
+        Returns the exposure of the sample.
+
+        Parameters
+        ----------
+        key : str
+            The name of the sample directory.
+
+        Returns
+        -------
+        exposure : tuple
+            The exposure of the sample as (POT, livetime).
+        """
+        exposure = toml.load(os.path.join(self._path, key, 'exposure.toml'))
+        return exposure['pot'], exposure['livetime']
+
+    def get_path(self, key, tree=None) -> str:
+        """
+        Returns the path to the directory of the sample or to the
+        columnar file of one of its TTrees.
+
+        Parameters
+        ----------
+        key : str
+            The name of the sample directory.
+        tree : str
+            The name of the TTree. If None, the path to the directory
+            of the sample is returned.
+
+        Returns
+        -------
+        path : str
+            The path to the sample directory or columnar file.
+        """
+        if tree is None:
+            return os.path.join(self._path, key)
+        for ext in FORMATS.values():
+            path = os.path.join(self._path, key, f'{tree}.{ext}')
+            if os.path.exists(path):
+                return path
+        raise FileNotFoundError(f"No columnar file found for tree '{tree}' of sample '{key}' in '{self._path}'.")
+
+    def num_entries(self, key, tree) -> int:
+        """
+        Returns the number of entries of a TTree of the sample. Only
+        the metadata of the file is read.
+
+        Parameters
+        ----------
+        key : str
+            The name of the sample directory.
+        tree : str
+            The name of the TTree.
+
+        Returns
+        -------
+        entries : int
+            The number of entries of the TTree.
+        """
+        path = self.get_path(key, tree)
+        if path.endswith(FORMATS['parquet']):
+            import pyarrow.parquet as pq
+            return pq.read_metadata(path).num_rows
+        import pyarrow as pa
+        import pyarrow.ipc as ipc
+        with pa.memory_map(path, 'r') as source:
+            reader = ipc.open_file(source)
+            return sum(reader.get_batch(i).num_rows for i in range(reader.num_record_batches))
+
+    def read(self, key, tree, columns=None) -> pd.DataFrame:
+        """
+        Reads the requested columns of a TTree of the sample. The file
+        is memory-mapped and only the requested columns are read.
+        Requested columns that are not present in the file are ignored.
+
+        Parameters
+        ----------
+        key : str
+            The name of the sample directory.
+        tree : str
+            The name of the TTree.
+        columns : list[str]
+            The names of the columns to read. If None, all columns are
+            read.
+
+        Returns
+        -------
+        data : pd.DataFrame
+            The requested columns of the TTree.
+        """
+        for fmt, ext in FORMATS.items():
+            path = os.path.join(self._path, key, f'{tree}.{ext}')
+            if not os.path.exists(path):
+                continue
+            if fmt == 'parquet':
+                import pyarrow.parquet as pq
+                schema = pq.read_schema(path, memory_map=True)
+                present = None if columns is None else [c for c in columns if c in schema.names]
+                return pq.read_table(path, columns=present, memory_map=True).to_pandas()
+            else:
+                import pyarrow as pa
+                import pyarrow.ipc as ipc
+                import pyarrow.feather as pf
+                with pa.memory_map(path, 'r') as source:
+                    names = ipc.open_file(source).schema.names
+                present = None if columns is None else [c for c in columns if c in names]
+                return pf.read_table(path, columns=present, memory_map=True).to_pandas()
+        raise FileNotFoundError(f"No columnar file found for tree '{tree}' of sample '{key}' in '{self._path}'.")
+
+def convert(rf_path, output, fmt='parquet', float32=False, keep_double=(), categorical=('category',)) -> None:
+    """
+    Converts the `events/<sample>/<tree>` TTrees of an analysis ROOT
+    file (as written by `ana::Analysis`) to a columnar layout that can
+    be read by `ColumnarDirectory`. Category columns are dictionary-
+    encoded and double-precision columns may optionally be stored as
+    single-precision floats.
+
+    Parameters
+    ----------
+    rf_path : str
+        The path to the input ROOT file.
+    output : str
+        The path to the output directory.
+    fmt : str
+        The output format. This can be either 'parquet' or 'feather'
+        (Arrow IPC).
+    float32 : bool
+        A flag toggling the conversion of double-precision columns to
+        single-precision floats.
+    keep_double : list[str]
+        The names of columns to keep in double precision even if
+        `float32` is set.
+    categorical : list[str]
+        The names of columns to dictionary-encode.
+
+    Returns
+    -------
+    None.
+    """
+    if fmt not in FORMATS:
+        raise ValueError(f"Unknown columnar format '{fmt}'. The format must be one of {list(FORMATS.keys())}.")
+    rf = uproot.open(rf_path)
+    events = rf['events']
+    for key in events.keys(recursive=False, cycle=False):
+        directory = events[key]
+        if not isinstance(directory, uproot.reading.ReadOnlyDirectory):
+            continue
+        os.makedirs(os.path.join(output, key), exist_ok=True)
+        exposure = {'pot': float(directory['POT'].to_numpy()[0][0]) if 'POT' in directory else 0.0,
+                    'livetime': float(directory['Livetime'].to_numpy()[0][0]) if 'Livetime' in directory else 0.0}
+        with open(os.path.join(output, key, 'exposure.toml'), 'w') as f:
+            toml.dump(exposure, f)
+
+        for tree in directory.keys(recursive=False, cycle=False, filter_classname='TTree'):
+            data = directory[tree].arrays(library='pd')
+            for c in data.columns:
+                if c in categorical:
+                    data[c] = data[c].astype('category')
+                elif float32 and c not in keep_double and data[c].dtype == np.float64:
+                    data[c] = data[c].astype(np.float32)
+            path = os.path.join(output, key, f'{tree}.{FORMATS[fmt]}')
+            if fmt == 'parquet':
+                data.to_parquet(path, engine='pyarrow', index=False)
+            else:
+                data.reset_index(drop=True).to_feather(path)
+            print(f"Wrote {len(data)} entries of {key}/{tree} to {path}")
+
+if __name__ == "__main__":
+    parser = ArgumentParser()
+    parser.add_argument("--input", help="Path to the input ROOT file")
+    parser.add_argument("--output", help="Path to the output directory")
+    parser.add_argument("--format", default='parquet', choices=list(FORMATS.keys()), help="Output format")
+    parser.add_argument("--float32", action='store_true', help="Store double-precision columns as single-precision floats")
+    parser.add_argument("--keep-double", nargs='*', default=[], help="Columns to keep in double precision")
+    parser.add_argument("--categorical", nargs='*', default=['category',], help="Columns to dictionary-encode")
+
+    args = parser.parse_args()
+    convert(args.input, args.output, args.format, args.float32, args.keep_double, args.categorical)
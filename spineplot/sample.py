@@ -1,5 +1,7 @@
+import os
 import numpy as np
 import pandas as pd
+from columnar import ColumnarDirectory
 
 class Sample:
     """
@@ -13,8 +15,9 @@ class Sample:
     _scaling_type : str
         The scaling type for the sample. This can be either 'pot' or
         'livetime'.
-    _file_handle : uproot.reading.ReadOnlyDirectory
-        The file handle for the input ROOT file.
+    _file_handle : uproot.reading.ReadOnlyDirectory or ColumnarDirectory
+        The file handle for the input ROOT file (or the directory of
+        columnar files converted from it).
     _exposure_pot : float
         The exposure of the sample in POT.
     _exposure_livetime : float
@@ -22,10 +25,21 @@ class Sample:
     _category_branch : str
         The name of the branch in the TTree containing the category
         labels.
-    _data : pd.DataFrame
-        The data comprising the sample.
+    _columns : dict
+        The cache of loaded branches. This is a map between the branch
+        name and a NumPy array of its values (concatenated over the
+        configured TTrees). Each branch is loaded once, on first
+        request.
+    _weight : float
+        The exposure normalization weight of the sample.
+    _sidecar : str
+        The path to the on-disk `.npz` cache of the loaded branches, or
+        None if the on-disk cache is disabled.
+    _dirty : bool
+        A flag indicating that branches have been loaded since the
+        sidecar was last written (see `flush()`).
     """
-    def __init__(self, name, rf, category_branch, key, scaling_type, trees, override_category=None) -> None:
+    def __init__(self, name, rf, category_branch, key, scaling_type, trees, override_category=None, columns=None, cache=False) -> None:
         """
         Initializes the Sample object with the given name and key.
 
@@ -33,8 +47,9 @@ class Sample:
         ----------
         name : str
             The name of the sample.
-        rf : uproot.reading.ReadOnlyDirectory
-            The file handle for the input ROOT file.
+        rf : uproot.reading.ReadOnlyDirectory or ColumnarDirectory
+            The file handle for the input ROOT file, or the directory
+            of columnar (Parquet/Feather) files converted from it.
         category_branch : str
             The name of the branch in the TTree containing the category
             labels. This categorical information is referenced in the
@@ -53,6 +68,17 @@ class Sample:
         override_category : int
             The category to override the category branch with if it is
             configured. Else, the category branch is left as is.
+        columns : list[str]
+            The names of the branches to load. Requested branches that
+            are not present in a TTree are ignored. These are loaded
+            together when the Sample is initialized; any other branch
+            is loaded on first request. If None, no branches are
+            preloaded.
+        cache : bool
+            A flag toggling the on-disk `.npz` sidecar cache of the
+            loaded branches. The sidecar is stored next to the input
+            file and is keyed by the modification time of the input,
+            so it is invalidated whenever the input is rewritten.
 
         Returns
         -------
@@ -60,16 +86,220 @@ class Sample:
         """
         self._name = name
         self._scaling_type = scaling_type
-        self._file_handle = rf[f'events/{key}']
-        self._exposure_pot = self._file_handle['POT'].to_numpy()[0][0]
-        self._exposure_livetime = self._file_handle['Livetime'].to_numpy()[0][0]
         self._category_branch = category_branch
+        self._key = key
+        self._trees = trees
+        self._override_category = override_category
+        self._columns = dict()
+        self._absent = set()
+        self._category_indices = None
+        self._dirty = False
+        self._weight = 1.0
 
-        self._data = pd.concat([self._file_handle[tree].arrays(library='pd') for tree in trees])
-        if self._category_branch not in self._data.columns:
-            self._data[self._category_branch] = 0
-        if override_category is not None:
-            self._data[self._category_branch] = override_category
+        if isinstance(rf, ColumnarDirectory):
+            self._file_handle = rf
+            self._exposure_pot, self._exposure_livetime = rf.get_exposure(key)
+            self._sidecar = os.path.join(rf.get_path(key), f'{"_".join(trees)}.npz') if cache else None
+            self._mtime = max(os.path.getmtime(rf.get_path(key, tree)) for tree in trees)
+        else:
+            self._file_handle = rf[f'events/{key}']
+            self._exposure_pot = self._file_handle['POT'].to_numpy()[0][0]
+            self._exposure_livetime = self._file_handle['Livetime'].to_numpy()[0][0]
+            path = rf.file_path
+            self._sidecar = f'{path}.{key}.{"_".join(trees)}.npz' if cache else None
+            self._mtime = os.path.getmtime(path) if os.path.exists(path) else None
+
+        self._load_sidecar()
+        self.load([category_branch,] + (list(columns) if columns is not None else []))
+        self.flush()
+
+    def _load_sidecar(self) -> None:
+        """
+        Loads the branches stored in the on-disk sidecar cache, if it
+        is enabled and was written for the current version of the
+        input file.
+
+        Returns
+        -------
+        None.
+        """
+        if self._sidecar is None or self._mtime is None or not os.path.exists(self._sidecar):
+            return
+        with np.load(self._sidecar, allow_pickle=False) as f:
+            if '__mtime__' not in f.files or f['__mtime__'][()] != self._mtime:
+                return
+            self._columns.update({k: f[k] for k in f.files if k != '__mtime__'})
+        print(f"Loaded {len(self._columns)} cached branches for {self._name} from {self._sidecar}")
+
+    def _write_sidecar(self) -> None:
+        """
+        Writes the loaded branches to the on-disk sidecar cache, if it
+        is enabled.
+
+        Returns
+        -------
+        None.
+        """
+        if self._sidecar is None or self._mtime is None:
+            return
+        tmp = f'{self._sidecar}.tmp.npz'
+        np.savez(tmp, __mtime__=np.array(self._mtime), **self._columns)
+        os.replace(tmp, self._sidecar)
+
+    def flush(self) -> None:
+        """
+        Writes the on-disk sidecar cache if branches have been loaded
+        since it was last written. The sidecar is written once after
+        the preloading in the constructor and should be flushed again
+        once a run has finished, rather than after every load.
+
+        Returns
+        -------
+        None.
+        """
+        if self._dirty:
+            self._write_sidecar()
+            self._dirty = False
+
+    def _tree_entries(self, tree) -> int:
+        """
+        Returns the number of entries of one of the configured TTrees.
+
+        Parameters
+        ----------
+        tree : str
+            The name of the TTree.
+
+        Returns
+        -------
+        entries : int
+            The number of entries of the TTree.
+        """
+        if isinstance(self._file_handle, ColumnarDirectory):
+            return self._file_handle.num_entries(self._key, tree)
+        return self._file_handle[tree].num_entries
+
+    def _read(self, columns) -> dict:
+        """
+        Reads the requested branches from the input, concatenated over
+        the configured TTrees. A branch that is present in some of the
+        TTrees but not in others is padded with NaN for the entries of
+        the TTrees that lack it, so that every branch stays aligned with
+        the category branch. Requested branches that are not present in
+        any TTree are ignored.
+
+        Parameters
+        ----------
+        columns : list[str]
+            The names of the branches to read.
+
+        Returns
+        -------
+        data : dict
+            A map between the branch name and a NumPy array of its
+            values.
+        """
+        if isinstance(self._file_handle, ColumnarDirectory):
+            frames = [self._file_handle.read(self._key, tree, columns) for tree in self._trees]
+        else:
+            read = lambda t : t.arrays([c for c in columns if c in t.keys()], library='pd')
+            frames = [read(self._file_handle[tree]) for tree in self._trees]
+        present = [c for c in columns if any(c in f.columns for f in frames)]
+        frames = [f.reset_index(drop=True).reindex(index=range(self._tree_entries(t)), columns=present) for f, t in zip(frames, self._trees)]
+        data = pd.concat(frames, ignore_index=True)
+        return {c: data[c].to_numpy() for c in present}
+
+    def load(self, columns) -> None:
+        """
+        Loads the requested branches into the column cache. Branches
+        that are already cached (or known to be absent from the input)
+        are not read again, and all missing branches are read in a
+        single pass over the input.
+
+        Parameters
+        ----------
+        columns : list[str]
+            The names of the branches to load.
+
+        Returns
+        -------
+        None.
+        """
+        missing = [c for c in dict.fromkeys(columns) if c not in self._columns and c not in self._absent]
+        if len(missing) == 0:
+            return
+        self._columns.update(self._read(missing))
+        self._absent.update(c for c in missing if c not in self._columns)
+        if self._category_branch in missing:
+            self._category_indices = None
+        self._dirty = any(c in self._columns for c in missing) or self._dirty
+
+    def get_column(self, column) -> np.ndarray:
+        """
+        Returns the values of a branch, loading it on first request.
+
+        Parameters
+        ----------
+        column : str
+            The name of the branch.
+
+        Returns
+        -------
+        values : np.ndarray
+            The values of the branch.
+        """
+        self.load([column,])
+        return self._columns[column]
+
+    def get_categories(self) -> np.ndarray:
+        """
+        Returns the category label of each entry of the sample. The
+        labels are taken from the category branch (or set to zero if
+        the branch is not present) and overridden with the configured
+        category, if any.
+
+        Returns
+        -------
+        categories : np.ndarray
+            The category label of each entry.
+        """
+        self.load([self._category_branch,])
+        if self._category_branch in self._columns:
+            categories = self._columns[self._category_branch]
+        else:
+            categories = np.zeros(self._get_entries(), dtype=int)
+        if self._override_category is not None:
+            categories = np.full(len(categories), self._override_category)
+        return categories
+
+    def _get_entries(self) -> int:
+        """
+        Returns the number of entries in the sample.
+
+        Returns
+        -------
+        entries : int
+            The number of entries in the sample.
+        """
+        if len(self._columns) == 0:
+            return sum(self._tree_entries(tree) for tree in self._trees)
+        return len(next(iter(self._columns.values())))
+
+    def _get_category_indices(self) -> dict:
+        """
+        Returns the indices of the entries of each category. The
+        indices are computed once and reused by every request.
+
+        Returns
+        -------
+        indices : dict
+            A map between the category label and the indices of the
+            entries in that category.
+        """
+        if self._category_indices is None:
+            categories = self.get_categories()
+            self._category_indices = {int(c): np.flatnonzero(categories == c) for c in np.unique(categories)}
+        return self._category_indices
 
     def override_exposure(self, exposure, exposure_type='pot') -> None:
         """
@@ -112,19 +342,21 @@ class Sample:
         None.
         """
         if target is None:
-            self._data['weight'] = 1
+            self._weight = 1.0
         elif self._scaling_type == 'pot':
-            self._data['weight'] = (target._exposure_pot / self._exposure_pot)
+            self._weight = (target._exposure_pot / self._exposure_pot)
             print(f"Setting weight for {self._name} to {target._exposure_pot / self._exposure_pot:.2e}")
         else:
-            self._data['weight'] = (target._exposure_livetime / self._exposure_livetime)
+            self._weight = (target._exposure_livetime / self._exposure_livetime)
             print(f"Setting weight for {self._name} to {target._exposure_livetime / self._exposure_livetime:.2e}")
 
     def get_data(self, variables) -> dict:
         """
         Returns the data for the given variable(s) in the sample. The
         data is returned as a dictionary with the category as the key
-        and the data for the requested variable as the value.
+        and the data for the requested variable as the value. The
+        requested branches are taken from the column cache (and loaded
+        on first request).
 
         Parameters
         ----------
@@ -136,21 +368,47 @@ class Sample:
         data : dict
             The data for the requested variable in the sample. The data
             is stored as a dictionary with the category as the key and
-            the data (a pandas Series) as the value.
+            the data (a list of NumPy arrays, one per variable) as the
+            value.
         weights : dict
             The weights for the requested variable in the sample. The
             weights are stored as a dictionary with the category as the
-            key and the weights (a pandas Series) as the value.
+            key and the weights (a NumPy array) as the value.
         """
+        self.load(variables)
         data = {}
         weights = {}
-        for category in np.unique(self._data[self._category_branch]):
-            data[int(category)] = list()
-            for v in variables:
-                data[int(category)].append(self._data[self._data[self._category_branch] == category][v])    
-            weights[int(category)] = self._data[self._data[self._category_branch] == category]['weight']
+        for category, indices in self._get_category_indices().items():
+            data[category] = [self._columns[v][indices] for v in variables]
+            weights[category] = np.full(len(indices), self._weight)
         return data, weights
 
+    def get_arrays(self, variables) -> tuple:
+        """
+        Returns the data for the given variable(s) in the sample as
+        flat arrays over all entries, along with the category label
+        and weight of each entry. This is the form used by the
+        single-pass histogramming engine, which bins all categories at
+        once.
+
+        Parameters
+        ----------
+        variables : list[str]
+            The names of the variables to retrieve.
+
+        Returns
+        -------
+        data : list[np.ndarray]
+            The values of each requested variable.
+        categories : np.ndarray
+            The category label of each entry.
+        weights : np.ndarray
+            The weight of each entry.
+        """
+        self.load(variables)
+        categories = self.get_categories()
+        return [self._columns[v] for v in variables], categories, np.full(len(categories), self._weight)
+
     def __str__(self) -> str:
         """
         Returns a string representation of the Sample object.
@@ -1,16 +1,17 @@
 from argparse import ArgumentParser
 from analysis import Analysis
 
-def main(config, input):
+def main(config, input, processes):
     ana = Analysis(config, input)
     ana.override_exposure("offbeam", 534163 * (0.0309638 / 0.0240737) * (1.92082e19 / 159049), exposure_type='pot')
-    ana.run()
+    ana.run(processes)
 
 
 if __name__ == "__main__":
     parser = ArgumentParser()
     parser.add_argument("--config", help="Path to the configuration file")
     parser.add_argument("--input", help="Path to the input ROOT file")
+    parser.add_argument("--processes", type=int, default=1, help="Number of worker processes used to produce the plots")
 
     args = parser.parse_args()
-    main(args.config, args.input)
\ No newline at end of file
+    main(args.config, args.input, args.processes)
\ No newline at end of file
@@ -7,6 +7,80 @@ import matplotlib.pyplot as plt
 class ConfigException(Exception):
     pass
 
+def bin_indices(values, nbins, range) -> np.ndarray:
+    """
+    Returns the index of the uniform bin containing each value. The
+    binning follows the conventions of `np.histogram`: the bins are
+    half-open except for the last, which includes the upper edge. As
+    in `np.histogram`, the index computed from the bin width is
+    corrected against the `np.linspace` edges, so values that fall on
+    a (rounded) edge land in the same bin as with `np.histogram`.
+
+    Parameters
+    ----------
+    values : np.ndarray
+        The values to bin.
+    nbins : int
+        The number of bins.
+    range : tuple
+        The lower and upper edges of the binning.
+
+    Returns
+    -------
+    indices : np.ndarray
+        The bin index of each value, or -1 for values outside of the
+        range (or NaN).
+    """
+    lo, hi = range
+    values = np.asarray(values, dtype=np.float64)
+    valid = (values >= lo) & (values <= hi)
+    edges = np.linspace(lo, hi, nbins + 1, endpoint=True)
+    v = values[valid]
+    i = np.minimum(((v - lo) * (nbins / (hi - lo))).astype(np.int64), nbins - 1)
+    i[v < edges[i]] -= 1
+    i[(v >= edges[i + 1]) & (i != nbins - 1)] += 1
+    indices = np.full(len(values), -1, dtype=np.int64)
+    indices[valid] = i
+    return indices
+
+def histogram_categories(values, nbins, ranges, labels, nlabels, weights) -> np.ndarray:
+    """
+    Fills the histograms of all categories in a single pass. Each entry
+    is assigned a flat index combining its category label and its bin
+    in each dimension, and the weighted histograms are then obtained
+    with a single `np.bincount` over these indices.
+
+    Parameters
+    ----------
+    values : list[np.ndarray]
+        The values of each dimension of the histogram.
+    nbins : list[int]
+        The number of bins in each dimension.
+    ranges : list[tuple]
+        The range of each dimension.
+    labels : np.ndarray
+        The label index of each entry in [0, nlabels), or -1 for
+        entries that do not belong to any label.
+    nlabels : int
+        The number of labels.
+    weights : np.ndarray
+        The weight of each entry.
+
+    Returns
+    -------
+    counts : np.ndarray
+        The weighted histograms, with shape (nlabels, *nbins).
+    """
+    flat = np.asarray(labels, dtype=np.int64)
+    valid = flat >= 0
+    for v, n, r in zip(values, nbins, ranges):
+        b = bin_indices(v, n, r)
+        valid &= b >= 0
+        flat = flat * n + b
+    size = nlabels * int(np.prod(nbins))
+    counts = np.bincount(flat[valid], weights=np.asarray(weights, dtype=np.float64)[valid], minlength=size)
+    return counts.reshape((nlabels, *nbins))
+
 class SpineSpectra:
     """
     A base class designed to encapsulate spectra for multiple variables
@@ -62,6 +136,37 @@ class SpineSpectra:
         self._colors = colors
         self._plotdata = None
 
+    def get_labels(self, categories) -> tuple:
+        """
+        Maps the category of each entry to the corresponding label of
+        the spectra. Labels are ordered by the category labels in the
+        order in which they are first encountered.
+
+        Parameters
+        ----------
+        categories : np.ndarray
+            The category label (in the input TTree) of each entry.
+
+        Returns
+        -------
+        names : list
+            The labels of the spectra present in the entries.
+        labels : np.ndarray
+            The index (into `names`) of the label of each entry, or -1
+            if the category of the entry is not configured.
+        """
+        unique, inverse = np.unique(categories, return_inverse=True)
+        names = list()
+        lut = np.full(len(unique), -1, dtype=np.int64)
+        for ui, c in enumerate(unique):
+            if int(c) not in self._categories.keys():
+                continue
+            label = self._categories[int(c)]
+            if label not in names:
+                names.append(label)
+            lut[ui] = names.index(label)
+        return names, lut[inverse]
+
 class SpineSpectra1D(SpineSpectra):
     """
     A class designed to encapsulate a single variable's spectrum for an
@@ -133,9 +238,10 @@ class SpineSpectra1D(SpineSpectra):
     def add_sample(self, sample) -> None:
         """
         Adds a sample to the SpineSpectra1D object. The sample's data
-        is extracted per category and stored for later plotting.
-        Multiple samples may have overlapping categories, so the data
-        is stored in a dictionary with the category as the key.
+        is binned for all categories at once and stored for later
+        plotting. Multiple samples may have overlapping categories, so
+        the data is stored in a dictionary with the category as the
+        key.
 
         Parameters
         ----------
@@ -150,16 +256,15 @@ class SpineSpectra1D(SpineSpectra):
         if self._plotdata is None:
             self._plotdata = {}
             self._binedges = {}
-        data, weights = sample.get_data([self._variable._key,])
-        for category, values in data.items():
-            values = values[0]
-            if category not in self._categories.keys():
-                continue
-            if self._categories[category] not in self._plotdata:
-                self._plotdata[self._categories[category]] = np.zeros(self._variable._nbins)
-            h = np.histogram(values, bins=self._variable._nbins, range=self._variable._range, weights=weights[category])
-            self._plotdata[self._categories[category]] += h[0]
-            self._binedges[self._categories[category]] = h[1]
+        data, categories, weights = sample.get_arrays([self._variable._key,])
+        names, labels = self.get_labels(categories)
+        counts = histogram_categories(data, [self._variable._nbins,], [self._variable._range,], labels, len(names), weights)
+        binedges = np.linspace(*self._variable._range, self._variable._nbins + 1)
+        for li, label in enumerate(names):
+            if label not in self._plotdata:
+                self._plotdata[label] = np.zeros(self._variable._nbins)
+            self._plotdata[label] += counts[li]
+            self._binedges[label] = binedges
 
     def plot(self, style, name) -> None:
         """
@@ -188,15 +293,16 @@ class SpineSpectra1D(SpineSpectra):
             histogram_mask = [li for li, label in enumerate(labels) if self._category_types[label] == 'histogram']
             scatter_mask = [li for li, label in enumerate(labels) if self._category_types[label] == 'scatter']
 
-            denominator = np.sum([data[i] for i in histogram_mask])
+            totals = np.sum(data, axis=1)
+            denominator = np.sum(totals[histogram_mask])
             if style.get_show_component_number() and style.get_show_component_percentage():
-                hlabel = lambda x : f'{np.sum(x):.1f}, {np.sum(x)/denominator:.2%}'
-                slabel = lambda x : f'{np.sum(x):.1f}'
-                labels = [f'{label} ({hlabel(d) if li in histogram_mask else slabel(d)})' for li, (label, d) in enumerate(zip(labels, data))]
+                hlabel = lambda x : f'{x:.1f}, {x/denominator:.2%}'
+                slabel = lambda x : f'{x:.1f}'
+                labels = [f'{label} ({hlabel(t) if li in histogram_mask else slabel(t)})' for li, (label, t) in enumerate(zip(labels, totals))]
             elif style.get_show_component_number():
-                labels = [f'{label} ({np.sum(d):.1f})' for label, d in zip(labels, data)]
+                labels = [f'{label} ({t:.1f})' for label, t in zip(labels, totals)]
             elif style.get_show_component_percentage():
-                labels = [f'{label} ({np.sum(d)/denominator:.2%})' if li in histogram_mask else label for li, (label, d) in enumerate(zip(labels, data))]
+                labels = [f'{label} ({t/denominator:.2%})' if li in histogram_mask else label for li, (label, t) in enumerate(zip(labels, totals))]
 
             reduce = lambda x : [x[i] for i in histogram_mask]
             self._ax.hist(reduce(bincenters), weights=reduce(data), bins=self._variable._nbins, range=self._variable._range, histtype='barstacked', label=reduce(labels), color=reduce(colors), stacked=True)
@@ -279,7 +385,8 @@ class SpineSpectra2D(SpineSpectra):
     def add_sample(self, sample) -> None:
         """
         Adds a sample to the SpineSpectra2D object. The sample's data
-        is extracted per category and stored for later plotting.
+        is binned for all categories at once and stored for later
+        plotting.
         Multiple samples may have overlapping categories, so the data
         is stored in a dictionary with the category as the key.
 
@@ -299,22 +406,27 @@ class SpineSpectra2D(SpineSpectra):
             self._plotdata_diagonal = {}
             self._binedges_diagonal = {}
 
-        data, weights = sample.get_data([self._variables[0]._key, self._variables[1]._key])        
-        for category, values in data.items():
-            if category not in self._categories.keys():
-                continue
-            if self._categories[category] not in self._plotdata:
-                self._plotdata[self._categories[category]] = np.zeros((self._variables[0]._nbins, self._variables[1]._nbins))
-            h = np.histogram2d(values[0], values[1], bins=(self._variables[0]._nbins, self._variables[1]._nbins), range=(self._variables[0]._range, self._variables[1]._range), weights=weights[category])
-            self._plotdata[self._categories[category]] += h[0]
-            self._binedges[self._categories[category]] = h[1]
-
-            if self._categories[category] not in self._plotdata_diagonal:
-                self._plotdata_diagonal[self._categories[category]] = np.zeros(self._variables[0]._nbins)
-            diag = np.divide(values[1] - values[0], values[0])#, where=values[0] != 0)
-            h = np.histogram(diag, bins=self._variables[0]._nbins, range=(-4,4), weights=weights[category])
-            self._plotdata_diagonal[self._categories[category]] += h[0]
-            self._binedges_diagonal[self._categories[category]] = h[1]
+        values, categories, weights = sample.get_arrays([self._variables[0]._key, self._variables[1]._key])
+        names, labels = self.get_labels(categories)
+        nbins = [self._variables[0]._nbins, self._variables[1]._nbins]
+        counts = histogram_categories(values, nbins, [self._variables[0]._range, self._variables[1]._range], labels, len(names), weights)
+        binedges = np.linspace(*self._variables[0]._range, nbins[0] + 1)
+
+        with np.errstate(divide='ignore', invalid='ignore'):
+            diag = np.divide(values[1] - values[0], values[0])
+        counts_diagonal = histogram_categories([diag,], [nbins[0],], [(-4, 4),], labels, len(names), weights)
+        binedges_diagonal = np.linspace(-4, 4, nbins[0] + 1)
+
+        for li, label in enumerate(names):
+            if label not in self._plotdata:
+                self._plotdata[label] = np.zeros(nbins)
+            self._plotdata[label] += counts[li]
+            self._binedges[label] = binedges
+
+            if label not in self._plotdata_diagonal:
+                self._plotdata_diagonal[label] = np.zeros(nbins[0])
+            self._plotdata_diagonal[label] += counts_diagonal[li]
+            self._binedges_diagonal[label] = binedges_diagonal
         
 
     def plot(self, style, name) -> None:
@@ -0,0 +1,249 @@
+/**
+ * @file bench_cafana.cc
+ * @brief Microbenchmarks of the cut and variable layer of the CAFAna
+ * analysis macros.
+ * @details This file contains Google Benchmark microbenchmarks of the
+ * templated cuts and variables in cafana/include (e.g.
+ * cuts::muon2024::all_1muNp_cut, vars::phiT, vars::alphaT). The cuts and
+ * variables are templated on the interaction type, so they are driven here
+ * over synthetic mock interactions and particles that carry the fields they
+ * access, and take the same (reco) code path as the CAF proxies. A loop over
+ * mock spills with the same shape as the lambda built by SpineVar is also
+ * benchmarked; it is a stand-in, not SpineVar itself (see
+ * @ref BM_spill_loop()). Each benchmark reports the time per interaction.
+ * @author mueller@fnal.gov
+ */
+#include <array>
+#include <vector>
+#include <random>
+#include <cstdint>
+#include <functional>
+
+#include "include/cuts.h"
+#include "include/variables.h"
+#include "include/muon2024/cuts_muon2024.h"
+
+#include "benchmark/benchmark.h"
+
+/**
+ * @struct MockParticle
+ * @brief Synthetic particle with the fields of a reco particle that are used
+ * by the cuts and variables.
+ */
+struct MockParticle
+{
+    int pid;
+    bool is_primary;
+    bool is_contained;
+    double calo_ke;
+    double csda_ke;
+    double mcs_ke;
+    std::array<double, 3> momentum;
+    std::array<double, 3> start_dir;
+    std::array<double, 3> end_point;
+};
+
+/**
+ * @struct MockInteraction
+ * @brief Synthetic interaction with the fields of a reco interaction that are
+ * used by the cuts and variables.
+ */
+struct MockInteraction
+{
+    int64_t id;
+    bool is_fiducial;
+    bool is_contained;
+    std::array<double, 3> vertex;
+    double flash_time;
+    int fmatched;
+    std::vector<MockParticle> particles;
+};
+
+/**
+ * @brief Generate a set of synthetic interactions.
+ * @details The interactions have between one and eight particles with a mix
+ * of types and energies such that a fraction of the interactions pass each of
+ * the topological cuts. The generator is seeded, so the sample is the same in
+ * every run.
+ * @param n The number of interactions.
+ * @return The interactions.
+ */
+static std::vector<MockInteraction> make_interactions(size_t n)
+{
+    std::mt19937_64 rng(20240601);
+    std::uniform_real_distribution<double> uniform(0, 1);
+    std::discrete_distribution<int> pid({5, 15, 25, 15, 40});
+    std::vector<MockInteraction> interactions(n);
+    for(size_t i(0); i < n; ++i)
+    {
+        MockInteraction & obj = interactions[i];
+        obj.id = i;
+        obj.is_fiducial = uniform(rng) < 0.9;
+        obj.is_contained = uniform(rng) < 0.8;
+        obj.vertex = {uniform(rng) * 400 - 200, uniform(rng) * 300 - 150, uniform(rng) * 900 - 450};
+        obj.flash_time = uniform(rng) * 4 - 1;
+        obj.fmatched = uniform(rng) < 0.95;
+        obj.particles.resize(1 + static_cast<size_t>(uniform(rng) * 8));
+        for(MockParticle & p : obj.particles)
+        {
+            p.pid = pid(rng);
+            p.is_primary = uniform(rng) < 0.7;
+            p.is_contained = uniform(rng) < 0.8;
+            p.calo_ke = uniform(rng) * 500;
+            p.csda_ke = uniform(rng) * 500;
+            p.mcs_ke = uniform(rng) * 500;
+            double phi(2 * M_PI * uniform(rng)), cost(2 * uniform(rng) - 1), sint(std::sqrt(1 - cost * cost));
+            double pmag(uniform(rng) * 1000);
+            p.start_dir = {sint * std::cos(phi), sint * std::sin(phi), cost};
+            p.momentum = {pmag * p.start_dir[0], pmag * p.start_dir[1], pmag * p.start_dir[2]};
+            p.end_point = {obj.vertex[0] + 50 * p.start_dir[0], obj.vertex[1] + 50 * p.start_dir[1], obj.vertex[2] + 50 * p.start_dir[2]};
+        }
+    }
+    return interactions;
+}
+
+/**
+ * @brief Access the shared sample of synthetic interactions.
+ * @return The interactions.
+ */
+static const std::vector<MockInteraction> & interactions()
+{
+    static const std::vector<MockInteraction> sample(make_interactions(1 << 14));
+    return sample;
+}
+
+/**
+ * @brief Set the per-interaction counter of a benchmark.
+ * @param state The benchmark state.
+ * @param n The number of interactions per iteration.
+ * @return void
+ */
+static void set_per_interaction(benchmark::State & state, size_t n)
+{
+    state.SetItemsProcessed(state.iterations() * n);
+    state.counters["ns/interaction"] = benchmark::Counter(1e-9 * n, benchmark::Counter::kIsIterationInvariantRate | benchmark::Counter::kInvert);
+}
+
+/**
+ * @brief Benchmark a cut over the synthetic interactions.
+ * @tparam fcut The cut.
+ * @param state The benchmark state.
+ * @return void
+ */
+template<bool (*fcut)(const MockInteraction &)>
+static void BM_cut(benchmark::State & state)
+{
+    const std::vector<MockInteraction> & sample = interactions();
+    for(auto _ : state)
+    {
+        size_t npass(0);
+        for(const MockInteraction & obj : sample)
+            npass += fcut(obj);
+        benchmark::DoNotOptimize(npass);
+    }
+    set_per_interaction(state, sample.size());
+}
+
+/**
+ * @brief Benchmark a variable over the synthetic interactions.
+ * @tparam fvar The variable.
+ * @param state The benchmark state.
+ * @return void
+ */
+template<double (*fvar)(const MockInteraction &)>
+static void BM_var(benchmark::State & state)
+{
+    const std::vector<MockInteraction> & sample = interactions();
+    for(auto _ : state)
+    {
+        double sum(0);
+        for(const MockInteraction & obj : sample)
+            sum += fvar(obj);
+        benchmark::DoNotOptimize(sum);
+    }
+    set_per_interaction(state, sample.size());
+}
+
+/**
+ * @brief Benchmark the primary counting that underlies the topological cuts.
+ * @param state The benchmark state.
+ * @return void
+ */
+static void BM_count_primaries(benchmark::State & state)
+{
+    const std::vector<MockInteraction> & sample = interactions();
+    for(auto _ : state)
+    {
+        uint64_t sum(0);
+        for(const MockInteraction & obj : sample)
+            sum += utilities::count_primaries(obj).value();
+        benchmark::DoNotOptimize(sum);
+    }
+    set_per_interaction(state, sample.size());
+}
+
+/**
+ * @struct MockSpill
+ * @brief Synthetic spill holding a contiguous range of the interactions.
+ */
+struct MockSpill
+{
+    std::vector<MockInteraction>::const_iterator first, last;
+};
+
+/**
+ * @brief Benchmark a per-spill loop shaped like the lambda of a SpineVar.
+ * @details The interactions are split into spills of the specified size.
+ * Each spill is processed by a lambda that captures the cut and the variable
+ * as function pointers and is held in a std::function taking the spill, in
+ * the same way that SpineVar captures its arguments and SpillMultiVar holds
+ * the lambda. The variable is evaluated on every interaction passing the cut
+ * and the results are collected in a vector per spill. SpineVar, SpineTree,
+ * and SpineVisitor themselves only accept the CAF proxy types, so this loop
+ * measures the cost of the dispatch pattern rather than those functions and
+ * cannot validate the fused loops of SpineTree.
+ * @param state The benchmark state (range(0) is the spill size).
+ * @return void
+ */
+static void BM_spill_loop(benchmark::State & state)
+{
+    const std::vector<MockInteraction> & sample = interactions();
+    size_t spill(state.range(0));
+    std::vector<MockSpill> spills;
+    for(size_t first(0); first < sample.size(); first += spill)
+        spills.push_back({sample.begin() + first, sample.begin() + std::min(first + spill, sample.size())});
+
+    bool (*fcut)(const MockInteraction &) = &cuts::muon2024::all_1muNp_cut<MockInteraction>;
+    double (*fvar)(const MockInteraction &) = &vars::phiT<MockInteraction>;
+    std::function<std::vector<double>(const MockSpill *)> multivar([fvar, fcut](const MockSpill * sr) -> std::vector<double>
+    {
+        std::vector<double> var;
+        for(auto i(sr->first); i != sr->last; ++i)
+        {
+            if(fcut(*i))
+                var.push_back(fvar(*i));
+        }
+        return var;
+    });
+    for(auto _ : state)
+    {
+        for(const MockSpill & s : spills)
+        {
+            std::vector<double> values(multivar(&s));
+            benchmark::DoNotOptimize(values.data());
+        }
+    }
+    set_per_interaction(state, sample.size());
+}
+
+BENCHMARK(BM_cut<cuts::fiducial_cut<MockInteraction>>);
+BENCHMARK(BM_cut<cuts::flash_cut_bnb<MockInteraction>>);
+BENCHMARK(BM_cut<cuts::muon2024::topological_1muNp_cut<MockInteraction>>);
+BENCHMARK(BM_cut<cuts::muon2024::all_1muNp_cut<MockInteraction>>);
+BENCHMARK(BM_var<vars::phiT<MockInteraction>>);
+BENCHMARK(BM_var<vars::alphaT<MockInteraction>>);
+BENCHMARK(BM_var<vars::leading_muon_pt<MockInteraction>>);
+BENCHMARK(BM_count_primaries);
+BENCHMARK(BM_spill_loop)->Arg(1)->Arg(4)->Arg(32);
+
+BENCHMARK_MAIN();
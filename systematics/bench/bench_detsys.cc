@@ -0,0 +1,214 @@
+/**
+ * @file bench_detsys.cc
+ * @brief Microbenchmarks of the detector systematics kernels.
+ * @details This file contains Google Benchmark microbenchmarks of the
+ * per-candidate kernels of the @ref sys::detsys::DetsysCalculator: the
+ * evaluation of a single weight, the copy of the tabulated weights at the
+ * configured z-scores, the batched evaluation over the universes, and the
+ * accumulation of the universe counts. The calculator is built from a
+ * synthetic configuration and synthetic variations (normally distributed
+ * values with shifted means and widths), with uniform and variable-width
+ * binnings of increasing size. Each benchmark reports the time per
+ * candidate.
+ * @author mueller@fnal.gov
+ */
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include <utility>
+#include <toml++/toml.h>
+
+#include "configuration.h"
+#include "detsys.h"
+
+#include "TMemFile.h"
+
+#include "benchmark/benchmark.h"
+
+/**
+ * @brief The synthetic configuration of the detector systematics.
+ * @details Three variations (nominal, +1 sigma, and -1 sigma) define a single
+ * detector systematic with three spline points.
+ */
+static const char * configuration = R"(
+[variations]
+keys = ['cv', 'p1', 'm1']
+histogram_destination = 'variations/'
+result_destination = 'results/'
+nuniverses = 1000
+seed = 20240601
+
+[[detsys]]
+name = 'bench'
+ordinate = 'cv'
+points = ['m1', 'cv', 'p1']
+scale = [1.0, 1.0, 1.0]
+zscores = [-1.0, 0.0, 1.0]
+)";
+
+/**
+ * @brief Generate the values of a variable for a synthetic sample.
+ * @param rng The random number generator.
+ * @param n The number of values.
+ * @param mean The mean of the values.
+ * @param sigma The standard deviation of the values.
+ * @return The values.
+ */
+static std::vector<double> make_values(std::mt19937_64 & rng, size_t n, double mean, double sigma)
+{
+    std::normal_distribution<double> normal(mean, sigma);
+    std::vector<double> values(n);
+    for(double & v : values)
+        v = normal(rng);
+    return values;
+}
+
+/**
+ * @struct Fixture
+ * @brief A calculator and a sample of candidate values.
+ */
+struct Fixture
+{
+    std::unique_ptr<TMemFile> output;
+    std::unique_ptr<sys::detsys::DetsysCalculator> calc;
+    size_t handle;
+    std::vector<double> candidates;
+};
+
+/**
+ * @brief Build (or fetch) the fixture for a binning.
+ * @details The binning spans [0, 3] with the specified number of bins. The
+ * variable-width binning has edges that grow quadratically, so a binary
+ * search is needed to find the bin. Fixtures are built once and shared by
+ * all benchmarks.
+ * @param nbins The number of bins.
+ * @param uniform Whether the bins are of uniform width.
+ * @return The fixture.
+ */
+static Fixture & fixture(size_t nbins, bool uniform)
+{
+    static std::map<std::pair<size_t, bool>, Fixture> fixtures;
+    auto [it, inserted] = fixtures.try_emplace({nbins, uniform});
+    Fixture & f = it->second;
+    if(!inserted)
+        return f;
+
+    std::vector<double> edges;
+    for(size_t i(0); i <= nbins; ++i)
+    {
+        double x(static_cast<double>(i) / nbins);
+        edges.push_back(3 * (uniform ? x : x * x));
+    }
+
+    std::mt19937_64 rng(20240601);
+    std::vector<std::vector<double>> values = {make_values(rng, 100000, 1.5, 0.5),
+                                               make_values(rng, 100000, 1.55, 0.52),
+                                               make_values(rng, 100000, 1.45, 0.48)};
+    sys::cfg::ConfigurationTable table(toml::parse(configuration));
+    f.output = std::make_unique<TMemFile>("bench_detsys.root", "RECREATE");
+    f.calc = std::make_unique<sys::detsys::DetsysCalculator>(table, f.output.get(), "x", edges, values, "", 20240601);
+    f.handle = f.calc->get_handle("bench");
+    f.candidates = make_values(rng, 1 << 14, 1.5, 0.6);
+    return f;
+}
+
+/**
+ * @brief Set the per-candidate counter of a benchmark.
+ * @param state The benchmark state.
+ * @param n The number of candidates per iteration.
+ * @return void
+ */
+static void set_per_candidate(benchmark::State & state, size_t n)
+{
+    state.SetItemsProcessed(state.iterations() * n);
+    state.counters["ns/candidate"] = benchmark::Counter(1e-9 * n, benchmark::Counter::kIsIterationInvariantRate | benchmark::Counter::kInvert);
+}
+
+/**
+ * @brief Benchmark the evaluation of a single weight per candidate.
+ * @param state The benchmark state (range(0) is the number of bins and
+ * range(1) is non-zero for a uniform binning).
+ * @return void
+ */
+static void BM_get_weight(benchmark::State & state)
+{
+    Fixture & f = fixture(state.range(0), state.range(1) != 0);
+    for(auto _ : state)
+    {
+        double sum(0);
+        for(double v : f.candidates)
+            sum += f.calc->get_weight(f.handle, v, 0.5);
+        benchmark::DoNotOptimize(sum);
+    }
+    set_per_candidate(state, f.candidates.size());
+}
+
+/**
+ * @brief Benchmark the copy of the tabulated weights at the configured
+ * z-scores per candidate (as written to the output TTree).
+ * @param state The benchmark state (see @ref BM_get_weight()).
+ * @return void
+ */
+static void BM_get_weights_knots(benchmark::State & state)
+{
+    Fixture & f = fixture(state.range(0), state.range(1) != 0);
+    std::vector<double> out(f.calc->get_zscores(f.handle).size());
+    for(auto _ : state)
+    {
+        for(double v : f.candidates)
+        {
+            f.calc->get_weights(f.handle, v, out.data());
+            benchmark::DoNotOptimize(out.data());
+        }
+    }
+    set_per_candidate(state, f.candidates.size());
+}
+
+/**
+ * @brief Benchmark the batched evaluation of the weights over a set of
+ * z-scores per candidate.
+ * @param state The benchmark state (see @ref BM_get_weight()).
+ * @return void
+ */
+static void BM_get_weights_batch(benchmark::State & state)
+{
+    Fixture & f = fixture(state.range(0), state.range(1) != 0);
+    std::mt19937_64 rng(1);
+    std::vector<double> zscores(make_values(rng, f.calc->get_nuniverses(), 0, 1));
+    std::vector<double> out(zscores.size());
+    for(auto _ : state)
+    {
+        for(size_t i(0); i < 256; ++i)
+        {
+            f.calc->get_weights(f.handle, f.candidates[i], zscores.data(), zscores.size(), out.data());
+            benchmark::DoNotOptimize(out.data());
+        }
+    }
+    set_per_candidate(state, 256);
+}
+
+/**
+ * @brief Benchmark the accumulation of the universe counts per candidate.
+ * @param state The benchmark state (see @ref BM_get_weight()).
+ * @return void
+ */
+static void BM_add_value(benchmark::State & state)
+{
+    Fixture & f = fixture(state.range(0), state.range(1) != 0);
+    for(auto _ : state)
+    {
+        for(double v : f.candidates)
+            f.calc->add_value(f.handle, v);
+        benchmark::ClobberMemory();
+    }
+    set_per_candidate(state, f.candidates.size());
+}
+
+BENCHMARK(BM_get_weight)->ArgNames({"nbins", "uniform"})->Args({1, 1})->Args({30, 1})->Args({300, 1})->Args({30, 0})->Args({300, 0});
+BENCHMARK(BM_get_weights_knots)->ArgNames({"nbins", "uniform"})->Args({30, 1})->Args({30, 0});
+BENCHMARK(BM_get_weights_batch)->ArgNames({"nbins", "uniform"})->Args({30, 1});
+BENCHMARK(BM_add_value)->ArgNames({"nbins", "uniform"})->Args({30, 1})->Args({300, 0});
+
+BENCHMARK_MAIN();
@@ -0,0 +1,284 @@
+/**
+ * @file cache.h
+ * @brief Header and implementation of the Match struct and the MatchCache
+ * class.
+ * @details This file contains the header and implementation of the Match
+ * struct, which stores a selected signal candidate matched to its parent
+ * neutrino in a CAF file, and the MatchCache class, which persists the
+ * matches of an input TTree in a cache file. Matching the candidates to the
+ * CAF files is by far the most expensive step of the processing, but it
+ * depends only on the selected candidates and the CAF files. With the cache,
+ * a rerun with a modified systematics configuration (e.g. an added weight
+ * parameter or a change to the detector systematics) rebuilds the output
+ * TTrees from the cached matches without reading any CAF file.
+ * @author mueller@fnal.gov
+ */
+#ifndef CACHE_H
+#define CACHE_H
+#include <cstdint>
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+
+#include "TFile.h"
+#include "TDirectory.h"
+#include "TTree.h"
+#include "TNamed.h"
+
+namespace sys::trees
+{
+    /**
+     * @brief Hash a block of memory with the 64-bit FNV-1a hash.
+     * @details Unlike std::hash, the FNV-1a hash is fully defined, so the
+     * value does not change between builds or platforms. The hash of
+     * consecutive blocks is accumulated by passing the previous value as
+     * the seed.
+     * @param data The block of memory.
+     * @param size The size of the block in bytes.
+     * @param seed The hash to continue from (the FNV offset basis by
+     * default).
+     * @return The hash.
+     */
+    inline uint64_t fnv1a(const void * data, size_t size, uint64_t seed = 14695981039346656037ULL)
+    {
+        const unsigned char * bytes(static_cast<const unsigned char *>(data));
+        for(size_t i(0); i < size; ++i)
+            seed = (seed ^ bytes[i]) * 1099511628211ULL;
+        return seed;
+    }
+
+    /**
+     * @brief Describe a file for the key of the match cache.
+     * @details The description is the path followed by the size and the
+     * modification time of the file, so that a file replaced under the same
+     * name changes the key. Files that cannot be inspected locally (e.g.
+     * remote URLs) are described by their path alone.
+     * @param path The path of the file.
+     * @return The description of the file.
+     */
+    inline std::string describe_file(const std::string & path)
+    {
+        struct stat info;
+        if(::stat(path.c_str(), &info) != 0)
+            return path + ":?";
+        return path + ":" + std::to_string(info.st_size) + ":" + std::to_string(info.st_mtime);
+    }
+
+    /**
+     * @brief Compute the key of the match cache from its description.
+     * @param description The full description of the inputs.
+     * @return The FNV-1a hash of the description, as a hexadecimal string.
+     */
+    inline std::string cache_key(const std::string & description)
+    {
+        std::ostringstream key;
+        key << std::hex << std::setw(16) << std::setfill('0') << fnv1a(description.data(), description.size());
+        return key.str();
+    }
+
+    /**
+     * @struct Match
+     * @brief Struct to store a selected signal candidate that has been matched
+     * to its parent neutrino in a CAF file.
+     * @details This struct stores the entry of the selected signal candidate
+     * in the input TTree, the run, subrun, and event of the CAF record, and
+     * a copy of the universe weights of the parent neutrino for each of the
+     * configured weight-based systematics. The weights of all systematics
+     * are stored back-to-back in a single flat vector in the order given by
+     * the "slots" passed to @ref match_caf(), with the weights of slot i
+     * occupying [offsets[i], offsets[i+1]).
+     */
+    struct Match
+    {
+        size_t entry;
+        Int_t run, subrun, event;
+        std::vector<float> weights;
+        std::vector<size_t> offsets;
+    };
+
+    /**
+     * @class MatchCache
+     * @brief Persistent cache of the matches of an input TTree.
+     * @details The matches of each input TTree are stored in a directory of
+     * the cache file named after the origin of the TTree, as a TTree
+     * "matches" (one entry per @ref Match, carrying the weights of every
+     * weight index of the parent neutrino) and a TNamed "key". The key
+     * identifies the inputs that the matches were derived from (the input
+     * file, the selected candidates, and the CAF files, see
+     * @ref cache_key()); the cache is only used if the stored key equals the
+     * key of the current inputs. The key is written (and the file header
+     * saved) only after the matches, so an interrupted run never leaves a
+     * cache that appears valid.
+     */
+    class MatchCache
+    {
+    public:
+        /**
+         * @brief Constructor for the MatchCache class.
+         * @details This constructor opens (or creates) the cache file and
+         * checks whether it holds valid matches for the origin and key.
+         * @param path The path to the cache file.
+         * @param origin The origin of the input TTree.
+         * @param key The key of the current inputs.
+         * @throw std::runtime_error if the cache file cannot be opened.
+         */
+        MatchCache(const std::string & path, const std::string & origin, const std::string & key)
+            : key(key), name(origin), file(nullptr), tree(nullptr), valid(false)
+        {
+            for(char & c : name)
+                c = c == '/' ? '_' : c;
+            file = TFile::Open(path.c_str(), "UPDATE");
+            if(file == nullptr || file->IsZombie())
+            {
+                delete file;
+                throw std::runtime_error("Failed to open the match cache " + path + ".");
+            }
+            TDirectory * dir(file->GetDirectory(name.c_str()));
+            TNamed * stored(dir != nullptr ? dir->Get<TNamed>("key") : nullptr);
+            valid = stored != nullptr && stored->GetTitle() == key && dir->Get<TTree>("matches") != nullptr;
+            delete stored;
+        }
+
+        /**
+         * @brief Destructor for the MatchCache class.
+         * @details The cache file is closed. Matches recorded on an invalid
+         * cache are only committed by @ref commit().
+         */
+        ~MatchCache()
+        {
+            file->Close();
+            delete file;
+        }
+
+        MatchCache(const MatchCache &) = delete;
+        MatchCache & operator=(const MatchCache &) = delete;
+
+        /**
+         * @brief Check if the cache holds valid matches for the inputs.
+         * @return true if the cached matches can be used.
+         */
+        bool is_valid() const { return valid; }
+
+        /**
+         * @brief Hand the cached matches to a function in batches.
+         * @tparam F The type of the function (called with a
+         * std::vector<Match> &).
+         * @param f The function.
+         * @param batch The number of matches per call.
+         * @return the number of cached matches.
+         */
+        template<class F>
+        size_t replay(F && f, size_t batch = 1024)
+        {
+            TTree * cached(file->GetDirectory(name.c_str())->Get<TTree>("matches"));
+            std::vector<float> * weights(nullptr);
+            std::vector<UInt_t> * offsets(nullptr);
+            cached->SetBranchAddress("entry", &b_entry);
+            cached->SetBranchAddress("run", &b_run);
+            cached->SetBranchAddress("subrun", &b_subrun);
+            cached->SetBranchAddress("event", &b_event);
+            cached->SetBranchAddress("weights", &weights);
+            cached->SetBranchAddress("offsets", &offsets);
+            std::vector<Match> matches;
+            for(Long64_t i(0); i < cached->GetEntries(); ++i)
+            {
+                cached->GetEntry(i);
+                matches.push_back({size_t(b_entry), b_run, b_subrun, b_event, *weights, std::vector<size_t>(offsets->begin(), offsets->end())});
+                if(matches.size() >= batch)
+                {
+                    f(matches);
+                    matches.clear();
+                }
+            }
+            if(!matches.empty())
+                f(matches);
+            Long64_t n(cached->GetEntries());
+            delete cached;
+            delete weights;
+            delete offsets;
+            return n;
+        }
+
+        /**
+         * @brief Record matches in the cache.
+         * @details Any previous contents of the directory of the origin are
+         * discarded when the first matches are recorded.
+         * @param matches The matches to record.
+         * @return void
+         */
+        void record(const std::vector<Match> & matches)
+        {
+            if(tree == nullptr)
+                create();
+            for(const Match & m : matches)
+            {
+                b_entry = m.entry;
+                b_run = m.run;
+                b_subrun = m.subrun;
+                b_event = m.event;
+                b_weights = m.weights;
+                b_offsets.assign(m.offsets.begin(), m.offsets.end());
+                tree->Fill();
+            }
+        }
+
+        /**
+         * @brief Write the recorded matches and the key to the cache file.
+         * @details The matches are written first, then the key, and the
+         * file header is saved last. A full TFile::Write() is not used, as
+         * it would write the objects of the file in an arbitrary order.
+         * @return void
+         */
+        void commit()
+        {
+            if(tree == nullptr)
+                create();
+            TDirectory * dir(file->GetDirectory(name.c_str()));
+            dir->WriteTObject(tree, "matches", "Overwrite");
+            TNamed stored("key", key.c_str());
+            dir->WriteTObject(&stored, "key", "Overwrite");
+            dir->SaveSelf(true);
+            file->SaveSelf(true);
+            file->Flush();
+            valid = true;
+        }
+
+    private:
+        /**
+         * @brief Create (or recreate) the directory and TTree of the origin.
+         * @return void
+         */
+        void create()
+        {
+            TDirectory * previous(gDirectory);
+            if(file->GetDirectory(name.c_str()) != nullptr)
+                file->Delete((name + ";*").c_str());
+            TDirectory * dir(file->mkdir(name.c_str()));
+            dir->cd();
+            tree = new TTree("matches", "matches");
+            tree->SetDirectory(dir);
+            tree->Branch("entry", &b_entry);
+            tree->Branch("run", &b_run);
+            tree->Branch("subrun", &b_subrun);
+            tree->Branch("event", &b_event);
+            tree->Branch("weights", &b_weights);
+            tree->Branch("offsets", &b_offsets);
+            previous->cd();
+        }
+
+        std::string key;
+        std::string name;
+        TFile * file;
+        TTree * tree;
+        bool valid;
+        Long64_t b_entry;
+        Int_t b_run, b_subrun, b_event;
+        std::vector<float> b_weights;
+        std::vector<UInt_t> b_offsets;
+    };
+} // namespace sys::trees
+#endif // CACHE_H
@@ -146,6 +146,20 @@ namespace sys::cfg
          */
         int64_t get_int_field(const std::string & field);
 
+        /**
+         * @brief Get the requested integer field from the ConfigurationTable
+         * and check that it is at least the given minimum.
+         * @details This function gets the requested integer field from the
+         * ConfigurationTable. If the field is not present or if its value is
+         * below the minimum (e.g. a negative count), the function throws an
+         * exception.
+         * @param field The name of the field that is requested.
+         * @param minimum The smallest allowed value of the field.
+         * @return The value of the requested integer field.
+         * @throw ConfigurationError
+         */
+        int64_t get_int_field(const std::string & field, int64_t minimum);
+
         /**
          * @brief Get the requested double field from the ConfigurationTable.
          * @details This function gets the requested double field from the
@@ -157,6 +171,17 @@ namespace sys::cfg
          */
         double get_double_field(const std::string & field);
 
+        /**
+         * @brief Get the requested boolean field from the ConfigurationTable.
+         * @details This function gets the requested boolean field from the
+         * ConfigurationTable. If the field is not present, the function throws
+         * an exception.
+         * @param field The name of the field that is requested.
+         * @return The value of the requested boolean field.
+         * @throw ConfigurationError
+         */
+        bool get_bool_field(const std::string & field);
+
         /**
          * @brief Get a list of all doubles matching the requested field name.
          * @details This function gets a list of all doubles matching the
@@ -12,6 +12,8 @@
 #ifndef DETSYS_H
 #define DETSYS_H
 #include <map>
+#include <cstdint>
+#include <string>
 #include <vector>
 
 #include "configuration.h"
@@ -62,7 +64,80 @@ namespace sys::detsys
         std::map<std::string, TH2D *> detsys_results2D;
         size_t nuniverses;
         double nominal_count;
+        uint64_t seed;
         std::vector<double> random_zscores;
+        std::vector<double> edges;
+        bool uniform;
+
+        /**
+         * @struct SplineTable
+         * @brief Flat table of the per-bin cubic spline coefficients for a
+         * single detector systematic.
+         * @details The coefficients are extracted from the TSpline3 objects
+         * after construction, so evaluation through the table reproduces
+         * TSpline3::Eval exactly. All bins of a detector systematic share the
+         * same knots (the configured z-scores), so the knots are stored once
+         * and the coefficients (y, b, c, d) of each segment are stored
+         * contiguously by bin then by segment. If the binning of the variable
+         * is uniform the bin is found with a single multiply, otherwise by a
+         * binary search of the bin edges. The table also
+         * holds the number of candidates added to each bin (including the
+         * underflow and overflow bins), which is all that is needed to build
+         * the universe results: the weight of a universe depends only on the
+         * bin, so the sum over candidates in a bin is the count times the
+         * weight.
+         */
+        struct SplineTable
+        {
+            double xmin;
+            double xmax;
+            double inverse_width;
+            int nbins;
+            bool uniform;
+            std::vector<double> edges;
+            size_t nsegments;
+            std::vector<double> knots;
+            std::vector<double> coefficients;
+            std::vector<double> counts;
+            std::vector<double> knot_weights;
+
+            /**
+             * @brief Find the bin of the variable.
+             * @param value The value of the variable.
+             * @return The (zero-indexed) bin, -1 for underflow, or nbins for
+             * overflow. A value exactly at the upper edge belongs to the last
+             * bin, a NaN or +inf belongs to the overflow, and -inf belongs
+             * to the underflow. Non-finite values are detected from their bit
+             * pattern, which -Ofast (finite math only) does not optimize away.
+             */
+            int find_bin(double value) const;
+
+            /**
+             * @brief Evaluate the spline of an in-range bin.
+             * @param bin The (zero-indexed) bin.
+             * @param zscore The z-score at which to evaluate the spline.
+             * @return The value of the spline.
+             */
+            double eval(int bin, double zscore) const;
+
+            /**
+             * @brief Evaluate the spline of an in-range bin for a batch of
+             * z-scores.
+             * @details The segment of each z-score is found by counting the
+             * knots below it rather than by a search, so the loop body is
+             * free of data-dependent branches and can be vectorized by the
+             * compiler.
+             * @param bin The (zero-indexed) bin.
+             * @param zscores The z-scores at which to evaluate the spline.
+             * @param n The number of z-scores.
+             * @param out The buffer (of length n) that receives the values.
+             * @return void
+             */
+            void eval(int bin, const double * zscores, size_t n, double * out) const;
+        };
+        std::map<std::string, size_t> handles;
+        std::vector<SplineTable> tables;
+        std::vector<std::string> names;
 
     public:
         /**
@@ -79,6 +154,27 @@ namespace sys::detsys
          */
         DetsysCalculator(sys::cfg::ConfigurationTable & table, TFile * output, TFile * input);
 
+        /**
+         * @brief Constructor for the DetsysCalculator class for a single
+         * binning variable.
+         * @details This constructor initializes the DetsysCalculator class
+         * for the specified binning variable using values of the variable
+         * that have already been read from each variation (see
+         * @ref read_variations()). This allows several calculators to share a
+         * single pass over the variation TTrees.
+         * @param table The configuration table.
+         * @param output The output file.
+         * @param variable The name of the binning variable.
+         * @param edges The bin edges of the binning variable.
+         * @param values The values of the binning variable for each entry of
+         * each variation (in the order of "variations.keys").
+         * @param subdirectory The subdirectory (with a trailing slash) of the
+         * histogram and result destinations used for the output.
+         * @param seed The seed of the universes.
+         * @see sys::cfg::ConfigurationTable
+         */
+        DetsysCalculator(sys::cfg::ConfigurationTable & table, TFile * output, const std::string & variable, const std::vector<double> & edges, const std::vector<std::vector<double>> & values, const std::string & subdirectory, uint64_t seed);
+
         /**
          * @brief Default constructor for the DetsysCalculator class.
          * @details This constructor initializes the DetsysCalculator class when
@@ -108,6 +204,45 @@ namespace sys::detsys
          */
         size_t get_nuniverses();
 
+        /**
+         * @brief Get the bin edges of a binning variable.
+         * @details This function reads the binning of a variable from the
+         * configuration table. The binning is given by the field
+         * "variations.binning.<variable>.edges" (variable-width bins) or
+         * "variations.binning.<variable>.bins" (an (nbins, min, max)
+         * triplet). For the variable named by "variations.variable", the
+         * triplet "variations.bins" is used if neither is present.
+         * @param table The configuration table.
+         * @param variable The name of the binning variable.
+         * @return The bin edges of the variable.
+         * @throw sys::cfg::ConfigurationError if the binning is missing or
+         * the edges are not strictly increasing.
+         */
+        static std::vector<double> get_binning(sys::cfg::ConfigurationTable & table, const std::string & variable);
+
+        /**
+         * @brief Get the seed of the universes.
+         * @details This function reads the optional "variations.seed" field.
+         * If the field is absent, a seed is drawn at random and printed.
+         * @param table The configuration table.
+         * @return The seed of the universes.
+         */
+        static uint64_t get_seed(sys::cfg::ConfigurationTable & table);
+
+        /**
+         * @brief Read the specified branches of each variation.
+         * @details This function reads the specified branches of the TTree of
+         * each variation. Only the specified branches are read from the file.
+         * The variations are read in parallel if the optional "input.threads"
+         * field is greater than one.
+         * @param table The configuration table.
+         * @param input The input file.
+         * @param branches The names of the branches to read.
+         * @return The values of each branch (inner index) for each variation
+         * (outer index, in the order of "variations.keys").
+         */
+        static std::vector<std::vector<std::vector<double>>> read_variations(sys::cfg::ConfigurationTable & table, TFile * input, const std::vector<std::string> & branches);
+
         /**
          * @brief Increment the nominal count by the specified value.
          * @details This function increments the nominal count by the specified
@@ -124,7 +259,31 @@ namespace sys::detsys
          * @param name The name of the detector systematic.
          * @return The z-scores for the specified detector systematic.
          */
-        std::vector<double> get_zscores(std::string name);
+        const std::vector<double> & get_zscores(const std::string & name);
+
+        /**
+         * @brief Get the z-scores for a specified detector systematic.
+         * @details This function returns the z-scores for the detector
+         * systematic with the specified handle.
+         * @param handle The handle of the detector systematic.
+         * @return The z-scores for the specified detector systematic.
+         * @see get_handle()
+         */
+        const std::vector<double> & get_zscores(size_t handle);
+
+        /**
+         * @brief Resolve the handle of a detector systematic.
+         * @details This function looks up a detector systematic by name and
+         * returns an integer handle that can be used with the handle-based
+         * overloads of @ref get_weight() and @ref add_value(). Resolving the
+         * handle once outside of the event loop avoids a string lookup on
+         * every call.
+         * @param name The name of the detector systematic.
+         * @return The handle of the detector systematic.
+         * @throw std::out_of_range if the detector systematic is not
+         * configured.
+         */
+        size_t get_handle(const std::string & name) const;
 
         /**
          * @brief Write the variation histograms to the output file.
@@ -170,7 +329,59 @@ namespace sys::detsys
          * @param zscore The z-score for which the weight is to be calculated.
          * @return The weight for the specified value and z-score.
          */
-        double get_weight(std::string name, double value, double zscore);
+        double get_weight(const std::string & name, double value, double zscore);
+
+        /**
+         * @brief Get the weight for a given value and z-score for a specified
+         * detector systematic.
+         * @details This function calculates the weight for a given value and
+         * z-score for the detector systematic with the specified handle. The
+         * bin is found using uniform-bin arithmetic (or a binary search for
+         * variable-width bins) and the spline is
+         * evaluated from the flat table of cubic coefficients, so the cost is
+         * a handful of multiply-adds. Values outside of the range of the
+         * variable receive a weight of one.
+         * @param handle The handle of the detector systematic.
+         * @param value The value for which the weight is to be calculated.
+         * @param zscore The z-score for which the weight is to be calculated.
+         * @return The weight for the specified value and z-score.
+         * @see get_handle()
+         */
+        double get_weight(size_t handle, double value, double zscore) const;
+
+        /**
+         * @brief Get the weights for a given value and a batch of z-scores
+         * for a specified detector systematic.
+         * @details This function fills a caller-supplied buffer with the
+         * weights for a given value and each of the z-scores. Values outside
+         * of the range of the variable receive a weight of one.
+         * @param handle The handle of the detector systematic.
+         * @param value The value for which the weights are to be calculated.
+         * @param zscores The z-scores for which the weights are to be
+         * calculated.
+         * @param n The number of z-scores.
+         * @param out The buffer (of length n) that receives the weights.
+         * @return void
+         * @see get_handle()
+         */
+        void get_weights(size_t handle, double value, const double * zscores, size_t n, double * out) const;
+
+        /**
+         * @brief Get the weights for a given value at the configured z-scores
+         * of a specified detector systematic.
+         * @details This function fills a caller-supplied buffer with the
+         * weights for a given value at each of the configured z-scores of the
+         * detector systematic (see @ref get_zscores()). These weights are
+         * tabulated for every bin when the calculator is constructed, so this
+         * is a copy of a single row of the table.
+         * @param handle The handle of the detector systematic.
+         * @param value The value for which the weights are to be calculated.
+         * @param out The buffer (of length get_zscores(handle).size()) that
+         * receives the weights.
+         * @return void
+         * @see get_handle()
+         */
+        void get_weights(size_t handle, double value, double * out) const;
 
         /**
          * @brief Add a value to the histogram for a specified detector
@@ -182,7 +393,118 @@ namespace sys::detsys
          * @param value The value to be added to the histogram.
          * @return void
          */
-        void add_value(std::string name, double value);
+        void add_value(const std::string & name, double value);
+
+        /**
+         * @brief Add a value to the histogram for a specified detector
+         * systematic.
+         * @details This function adds a value to the histogram for the
+         * detector systematic with the specified handle while respecting the
+         * pre-rolled z-scores of the random universes.
+         * @param handle The handle of the detector systematic.
+         * @param value The value to be added to the histogram.
+         * @return void
+         * @see get_handle()
+         */
+        void add_value(size_t handle, double value);
+    };
+    /**
+     * @class DetsysRegistry
+     * @brief Collection of DetsysCalculators for several binning variables.
+     * @details This class holds one @ref DetsysCalculator per binning
+     * variable, each building the splines of every configured detector
+     * systematic in the binning of its variable. The binning variables are
+     * listed by the optional "variations.variables" field (defaulting to the
+     * single "variations.variable") and the binning of each is configured as
+     * described in @ref DetsysCalculator::get_binning(), so variable-width
+     * bins are supported. The variation TTrees are read once for all
+     * variables. With more than one variable, the output of each calculator
+     * is written to a subdirectory (named after the variable) of the
+     * histogram and result destinations, and the weight branches of each
+     * detector systematic are named "<systematic>_<variable>".
+     *
+     * The registry also histograms the optional "variations.extra_variables"
+     * for each variation. Their binnings are given by "variations.extra_bins"
+     * as consecutive (nbins, min, max) triplets. These histograms are only
+     * written to the output.
+     */
+    class DetsysRegistry
+    {
+    private:
+        std::vector<DetsysCalculator> calculators;
+        std::vector<std::string> variables;
+        TDirectory * histogram_directory;
+        std::map<std::string, TH1D *> extra_histograms;
+
+    public:
+        /**
+         * @brief Constructor for the DetsysRegistry class.
+         * @details This constructor reads the binning variables (and any
+         * extra variables) of each variation in a single pass and creates a
+         * calculator for each binning variable.
+         * @param table The configuration table.
+         * @param output The output file.
+         * @param input The input file.
+         * @throw sys::cfg::ConfigurationError if the binning of a variable is
+         * misconfigured.
+         * @see sys::cfg::ConfigurationTable
+         */
+        DetsysRegistry(sys::cfg::ConfigurationTable & table, TFile * output, TFile * input);
+
+        /**
+         * @brief Default constructor for the DetsysRegistry class.
+         * @details This constructor creates an empty registry, which is used
+         * when no detector systematics are configured.
+         */
+        DetsysRegistry();
+
+        /**
+         * @brief Get the number of calculators (binning variables).
+         * @return The number of calculators.
+         */
+        size_t size() const;
+
+        /**
+         * @brief Access a calculator by index.
+         * @param index The index of the calculator.
+         * @return The calculator.
+         */
+        DetsysCalculator & operator[](size_t index);
+
+        /**
+         * @brief Get the name of the weight branch of a detector systematic.
+         * @details The branch is named after the detector systematic, with
+         * the name of the binning variable appended if more than one binning
+         * variable is configured.
+         * @param index The index of the calculator.
+         * @param name The name of the detector systematic.
+         * @return The name of the weight branch.
+         */
+        std::string get_branch_name(size_t index, const std::string & name) const;
+
+        /**
+         * @brief Increment the nominal count of every calculator.
+         * @param value The value by which the nominal count is to be
+         * incremented.
+         * @return void
+         */
+        void increment_nominal_count(double value);
+
+        /**
+         * @brief Write the variation histograms and splines of every
+         * calculator, and the extra variable histograms, to the output file.
+         * @return void
+         * @see DetsysCalculator::write()
+         */
+        void write();
+
+        /**
+         * @brief Write the detector systematic results of every calculator
+         * to the output file.
+         * @return void
+         * @see DetsysCalculator::write_results()
+         */
+        void write_results();
     };
 } // namespace sys::detsys
 #endif // DETSYS_H
\ No newline at end of file
@@ -0,0 +1,281 @@
+/**
+ * @file index.h
+ * @brief Header and implementation of the CandidateIndex class.
+ * @details This file contains the header and implementation of the
+ * CandidateIndex class. The CandidateIndex class is built on a flat,
+ * open-addressing hash table and maps the (run, subrun, event, nu_id) of a
+ * selected signal candidate to its entry in the input TTree. It is used to
+ * match the neutrino interactions in the CAF files to the selected signal
+ * candidates with a single lookup per interaction.
+ * @author mueller@fnal.gov
+ */
+#ifndef INDEX_H
+#define INDEX_H
+#include <cstdint>
+#include <cstddef>
+#include <limits>
+#include <vector>
+
+/**
+ * @namespace sys::index
+ * @brief Namespace for the classes that index the selected signal candidates.
+ * @details This namespace contains the classes that are used to index the
+ * selected signal candidates by their (run, subrun, event, nu_id) so that
+ * they can be efficiently matched to the neutrino interactions in the CAF
+ * files.
+ */
+namespace sys::index
+{
+    /**
+     * @struct Key
+     * @brief Packed integer key for a single neutrino interaction.
+     * @details The run and subrun are packed into the upper word and the
+     * event and nu_id into the lower word. Each of the four fields fits in
+     * 32 bits, so the packing is lossless.
+     */
+    struct Key
+    {
+        uint64_t hi;
+        uint64_t lo;
+        bool operator==(const Key & other) const { return hi == other.hi && lo == other.lo; }
+    };
+
+    /**
+     * @brief Pack the (run, subrun, event, nu_id) of an interaction into a
+     * @ref Key.
+     * @param run The run number.
+     * @param subrun The subrun number.
+     * @param event The event number.
+     * @param nu_id The index of the neutrino within the event.
+     * @return The packed key.
+     */
+    inline Key pack(int64_t run, int64_t subrun, int64_t event, int64_t nu_id)
+    {
+        return Key{(uint64_t(uint32_t(run)) << 32) | uint32_t(subrun), (uint64_t(uint32_t(event)) << 32) | uint32_t(nu_id)};
+    }
+
+    /**
+     * @class FlatTable
+     * @brief Flat open-addressing hash table from a packed @ref Key to an
+     * entry number.
+     * @details The table is stored as a single contiguous array with a
+     * power-of-two capacity and is probed linearly, so a lookup is a hash of
+     * two words followed by (typically) a single cache line read. The load
+     * factor is kept at or below one half. As with std::map::insert, the first
+     * entry inserted for a given key is the one that is kept.
+     */
+    class FlatTable
+    {
+    public:
+        /**
+         * @brief Sentinel value returned by @ref find() when the key is not
+         * present in the table.
+         */
+        static constexpr size_t npos = std::numeric_limits<size_t>::max();
+
+        /**
+         * @brief Default constructor for the FlatTable class.
+         * @details This constructor initializes an empty table with a small
+         * initial capacity.
+         */
+        FlatTable() : count(0) { slots.resize(16, Slot{Key{0, 0}, npos}); }
+
+        /**
+         * @brief Reserve space for the specified number of keys.
+         * @details This function grows the table so that the specified number
+         * of keys can be inserted without rehashing.
+         * @param n The number of keys to reserve space for.
+         * @return void
+         */
+        void reserve(size_t n)
+        {
+            size_t capacity(slots.size());
+            while(capacity < 2 * n)
+                capacity *= 2;
+            if(capacity != slots.size())
+                rehash(capacity);
+        }
+
+        /**
+         * @brief Insert a key into the table.
+         * @details This function inserts the specified key and entry into the
+         * table. If the key is already present, the table is left unchanged.
+         * @param key The packed key.
+         * @param entry The entry associated with the key.
+         * @return true if the key was inserted.
+         */
+        bool insert(const Key & key, size_t entry)
+        {
+            if(2 * (count + 1) > slots.size())
+                rehash(2 * slots.size());
+            size_t i(probe(key));
+            if(slots[i].entry != npos)
+                return false;
+            slots[i] = Slot{key, entry};
+            ++count;
+            return true;
+        }
+
+        /**
+         * @brief Find a key in the table.
+         * @param key The packed key.
+         * @return The entry associated with the key, or @ref npos if the key
+         * is not present.
+         */
+        size_t find(const Key & key) const { return slots[probe(key)].entry; }
+
+        /**
+         * @brief Get the number of keys in the table.
+         * @return The number of keys in the table.
+         */
+        size_t size() const { return count; }
+
+    private:
+        /**
+         * @struct Slot
+         * @brief A single slot of the hash table. Empty slots have an entry of
+         * @ref npos.
+         */
+        struct Slot
+        {
+            Key key;
+            size_t entry;
+        };
+
+        std::vector<Slot> slots;
+        size_t count;
+
+        /**
+         * @brief Hash a packed key.
+         * @details The two words are combined and passed through the
+         * splitmix64 finalizer, which spreads the (highly structured) run,
+         * subrun, and event numbers across the full 64 bits.
+         * @param key The packed key.
+         * @return The hash of the key.
+         */
+        static uint64_t hash(const Key & key)
+        {
+            uint64_t h(key.hi * 0x9e3779b97f4a7c15ULL ^ key.lo);
+            h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+            return h ^ (h >> 31);
+        }
+
+        /**
+         * @brief Find the slot holding the key, or the empty slot where it
+         * would be inserted.
+         * @param key The packed key.
+         * @return The index of the slot.
+         */
+        size_t probe(const Key & key) const
+        {
+            size_t mask(slots.size() - 1);
+            size_t i(hash(key) & mask);
+            while(slots[i].entry != npos && !(slots[i].key == key))
+                i = (i + 1) & mask;
+            return i;
+        }
+
+        /**
+         * @brief Rebuild the table with the specified capacity.
+         * @param capacity The new capacity (a power of two).
+         * @return void
+         */
+        void rehash(size_t capacity)
+        {
+            std::vector<Slot> old(capacity, Slot{Key{0, 0}, npos});
+            old.swap(slots);
+            for(const Slot & s : old)
+            {
+                if(s.entry != npos)
+                    slots[probe(s.key)] = s;
+            }
+        }
+    };
+
+    /**
+     * @class CandidateIndex
+     * @brief Index of the selected signal candidates.
+     * @details This class maps the (run, subrun, event, nu_id) of a selected
+     * signal candidate to its entry in the input TTree. Alongside the
+     * per-interaction table, a second table records each (run, subrun,
+     * event) that contains at least one candidate. This allows the CAF loop
+     * to reject an event using only the header fields, without decoding the
+     * (large) true interaction array.
+     */
+    class CandidateIndex
+    {
+    public:
+        /**
+         * @brief Sentinel value returned by @ref find() when the interaction is
+         * not a selected signal candidate.
+         */
+        static constexpr size_t npos = FlatTable::npos;
+
+        /**
+         * @brief Reserve space for the specified number of candidates.
+         * @param n The number of candidates to reserve space for.
+         * @return void
+         */
+        void reserve(size_t n)
+        {
+            interactions.reserve(n);
+            events.reserve(n);
+        }
+
+        /**
+         * @brief Insert a candidate into the index.
+         * @details If the (run, subrun, event, nu_id) is already present, the
+         * index is left unchanged.
+         * @param run The run number.
+         * @param subrun The subrun number.
+         * @param event The event number.
+         * @param nu_id The index of the neutrino within the event.
+         * @param entry The entry of the candidate in the input TTree.
+         * @return true if the candidate was inserted.
+         */
+        bool insert(int64_t run, int64_t subrun, int64_t event, int64_t nu_id, size_t entry)
+        {
+            events.insert(pack(run, subrun, event, -1), entry);
+            return interactions.insert(pack(run, subrun, event, nu_id), entry);
+        }
+
+        /**
+         * @brief Check if an event contains at least one selected signal
+         * candidate.
+         * @param run The run number.
+         * @param subrun The subrun number.
+         * @param event The event number.
+         * @return true if the event contains a candidate.
+         */
+        bool has_event(int64_t run, int64_t subrun, int64_t event) const
+        {
+            return events.find(pack(run, subrun, event, -1)) != npos;
+        }
+
+        /**
+         * @brief Find a candidate in the index.
+         * @param run The run number.
+         * @param subrun The subrun number.
+         * @param event The event number.
+         * @param nu_id The index of the neutrino within the event.
+         * @return The entry of the candidate in the input TTree, or @ref npos
+         * if the interaction is not a selected signal candidate.
+         */
+        size_t find(int64_t run, int64_t subrun, int64_t event, int64_t nu_id) const
+        {
+            return interactions.find(pack(run, subrun, event, nu_id));
+        }
+
+        /**
+         * @brief Get the number of candidates in the index.
+         * @return The number of candidates in the index.
+         */
+        size_t size() const { return interactions.size(); }
+
+    private:
+        FlatTable interactions;
+        FlatTable events;
+    };
+} // namespace sys::index
+#endif // INDEX_H
@@ -0,0 +1,187 @@
+/**
+ * @file prefetch.h
+ * @brief Header and implementation of the Prefetcher class.
+ * @details This file contains the header and implementation of the Prefetcher
+ * class and the function used to open the input CAF files. The Prefetcher
+ * class opens and warms the input CAF files ahead of the matching, so that
+ * the (remote) file open and first-basket latency of each file overlaps with
+ * the processing of the previous files.
+ * @author mueller@fnal.gov
+ */
+#ifndef PREFETCH_H
+#define PREFETCH_H
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "TFile.h"
+#include "TTree.h"
+#include "TBranch.h"
+
+namespace sys::trees
+{
+    /**
+     * @brief Open and validate a single CAF file.
+     * @details This function opens the input CAF file and checks that the
+     * file is not a zombie (corrupted) and that it contains the TTree
+     * "recTree". If the file is a zombie or does not contain the TTree, the
+     * function prints an error message and returns a null pointer.
+     * Practically, skipping a file means that signal events from that file
+     * will not be included in the output ROOT file, though a situation where
+     * this occurs is not expected. A TTreeCache is attached to "recTree" that
+     * covers only the branches read during the matching (the three header
+     * branches and the true interactions), so each cluster of these branches
+     * is fetched with a single vectored read.
+     * @param input_file The path to the CAF file.
+     * @param cache_size The size of the TTreeCache in bytes.
+     * @param warm Whether to read the first entry of the header branches,
+     * which fills the cache with the first cluster.
+     * @return The opened CAF file, or a null pointer if the file is invalid.
+     */
+    inline TFile * open_caf(const std::string & input_file, Long64_t cache_size, bool warm)
+    {
+        TFile * caf = TFile::Open(input_file.c_str(), "READ");
+        if(caf == nullptr || caf->IsZombie() || !caf->GetListOfKeys()->Contains("recTree"))
+        {
+            std::cerr << "Error: File" << input_file << " does not exist." << std::endl;
+            delete caf;
+            return nullptr;
+        }
+
+        TTree * tree = caf->Get<TTree>("recTree");
+        tree->SetCacheSize(cache_size);
+        for(const char * br : {"rec.hdr.run", "rec.hdr.subrun", "rec.hdr.evt", "rec.mc.nu*"})
+            tree->AddBranchToCache(br, true);
+        tree->StopCacheLearningPhase();
+        if(warm)
+        {
+            TBranch * branch = tree->GetBranch("rec.hdr.run");
+            if(branch != nullptr && tree->GetEntries() > 0)
+                branch->GetEntry(0);
+        }
+        return caf;
+    }
+
+    /**
+     * @class Prefetcher
+     * @brief Opens and warms the input CAF files ahead of the matching.
+     * @details This class runs a background thread that opens the input CAF
+     * files in the order of the file list (see @ref open_caf()). At most
+     * "depth" files are held open and unclaimed at any time, which bounds the
+     * memory held by the prefetched caches. Files are claimed with
+     * @ref take(), which blocks until the requested file has been opened.
+     * Each file must be claimed exactly once, and the caller takes ownership
+     * of the returned file. ROOT thread safety must be enabled before the
+     * Prefetcher is constructed.
+     */
+    class Prefetcher
+    {
+    public:
+        /**
+         * @brief Constructor for the Prefetcher class.
+         * @details This constructor starts the background thread that opens
+         * the input CAF files.
+         * @param files The paths to the input CAF files.
+         * @param depth The maximum number of files held open ahead of the
+         * matching.
+         * @param cache_size The size of the TTreeCache in bytes.
+         */
+        Prefetcher(const std::vector<std::string> & files, size_t depth, Long64_t cache_size)
+            : files(files), depth(depth > 0 ? depth : 1), cache_size(cache_size), opened(files.size(), nullptr), ready(files.size(), false), pending(0), stop(false)
+        {
+            worker = std::thread([this]{ run(); });
+        }
+
+        /**
+         * @brief Destructor for the Prefetcher class.
+         * @details This destructor stops the background thread and closes any
+         * files that have been opened but not claimed.
+         */
+        ~Prefetcher()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stop = true;
+            }
+            cv.notify_all();
+            worker.join();
+            for(size_t i(0); i < files.size(); ++i)
+            {
+                if(ready[i] && opened[i] != nullptr)
+                {
+                    opened[i]->Close();
+                    delete opened[i];
+                }
+            }
+        }
+
+        Prefetcher(const Prefetcher &) = delete;
+        Prefetcher & operator=(const Prefetcher &) = delete;
+
+        /**
+         * @brief Claim an opened CAF file.
+         * @details This function blocks until the specified file has been
+         * opened and then hands it to the caller.
+         * @param i The index of the file in the file list.
+         * @return The opened CAF file, or a null pointer if the file is
+         * invalid.
+         */
+        TFile * take(size_t i)
+        {
+            TFile * caf;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cv.wait(lock, [&]{ return ready[i]; });
+                caf = opened[i];
+                opened[i] = nullptr;
+                ready[i] = false;
+                --pending;
+            }
+            cv.notify_all();
+            return caf;
+        }
+
+    private:
+        std::vector<std::string> files;
+        size_t depth;
+        Long64_t cache_size;
+        std::vector<TFile *> opened;
+        std::vector<bool> ready;
+        size_t pending;
+        bool stop;
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::thread worker;
+
+        /**
+         * @brief Open the input CAF files in order.
+         * @details This function is run by the background thread. It waits
+         * until fewer than "depth" files are pending before opening the next.
+         * @return void
+         */
+        void run()
+        {
+            for(size_t i(0); i < files.size(); ++i)
+            {
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    cv.wait(lock, [&]{ return stop || pending < depth; });
+                    if(stop)
+                        return;
+                }
+                TFile * caf = open_caf(files[i], cache_size, true);
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    opened[i] = caf;
+                    ready[i] = true;
+                    ++pending;
+                }
+                cv.notify_all();
+            }
+        }
+    };
+} // namespace sys::trees
+#endif // PREFETCH_H
@@ -0,0 +1,233 @@
+/**
+ * @file timing.h
+ * @brief Header and implementation of the stage timers and counters of the
+ * systematics processing.
+ * @details This file contains the header and implementation of a small set of
+ * utilities for recording the time spent in each stage of the processing
+ * (e.g. opening the CAF files, reading events, evaluating the detector
+ * systematics, filling the output TTrees) and counters of the work done
+ * (events read, neutrinos checked, matches, bytes read). The results are
+ * accumulated in a process-wide @ref Stats object, which can print a summary
+ * table and serialize itself as JSON.
+ *
+ * Timers in hot loops should use an @ref Accumulator, which only reads the
+ * clock and is committed to the @ref Stats object once at the end of the
+ * loop. A @ref ScopedTimer commits on destruction and is intended for coarse
+ * stages. The stage times of work done on several threads are summed, so they
+ * are thread-seconds rather than wall-clock seconds.
+ * @author mueller@fnal.gov
+ */
+#ifndef TIMING_H
+#define TIMING_H
+#include <map>
+#include <vector>
+#include <string>
+#include <mutex>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <ostream>
+#include <sstream>
+
+/**
+ * @namespace sys::timing
+ * @brief Namespace for the stage timers and counters.
+ */
+namespace sys::timing
+{
+    /**
+     * @class Stats
+     * @brief Process-wide collection of stage times and counters.
+     * @details Stages and counters are identified by name and are reported
+     * in the order in which they are first recorded. All methods are
+     * thread-safe.
+     */
+    class Stats
+    {
+    public:
+        /**
+         * @brief Add time to a stage.
+         * @param stage The name of the stage.
+         * @param seconds The time (in seconds) to add.
+         * @param calls The number of calls to add.
+         * @return void
+         */
+        void add_time(const std::string & stage, double seconds, uint64_t calls = 1)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto [it, inserted] = stages.try_emplace(stage);
+            if(inserted)
+                stage_order.push_back(stage);
+            it->second.seconds += seconds;
+            it->second.calls += calls;
+        }
+
+        /**
+         * @brief Add to a counter.
+         * @param counter The name of the counter.
+         * @param n The value to add.
+         * @return void
+         */
+        void add_count(const std::string & counter, uint64_t n)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto [it, inserted] = counters.try_emplace(counter, 0);
+            if(inserted)
+                counter_order.push_back(counter);
+            it->second += n;
+        }
+
+        /**
+         * @brief Print a summary table of the stages and counters.
+         * @param os The output stream.
+         * @return void
+         */
+        void print(std::ostream & os)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            char line[128];
+            os << "Timing summary:" << std::endl;
+            std::snprintf(line, sizeof(line), "  %-28s %12s %12s %12s", "stage", "seconds", "calls", "us/call");
+            os << line << std::endl;
+            for(const std::string & name : stage_order)
+            {
+                const Stage & s = stages[name];
+                std::snprintf(line, sizeof(line), "  %-28s %12.3f %12llu %12.3f", name.c_str(), s.seconds, static_cast<unsigned long long>(s.calls), s.calls > 0 ? 1e6 * s.seconds / s.calls : 0.0);
+                os << line << std::endl;
+            }
+            std::snprintf(line, sizeof(line), "  %-28s %12s", "counter", "value");
+            os << line << std::endl;
+            for(const std::string & name : counter_order)
+            {
+                std::snprintf(line, sizeof(line), "  %-28s %12llu", name.c_str(), static_cast<unsigned long long>(counters[name]));
+                os << line << std::endl;
+            }
+        }
+
+        /**
+         * @brief Serialize the stages and counters as JSON.
+         * @details The JSON object has the form {"stages": {"<name>":
+         * {"seconds": s, "calls": n}, ...}, "counters": {"<name>": n, ...}}.
+         * @return The JSON string.
+         */
+        std::string to_json()
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            std::ostringstream os;
+            os.precision(9);
+            os << "{\"stages\": {";
+            for(size_t i(0); i < stage_order.size(); ++i)
+            {
+                const Stage & s = stages[stage_order[i]];
+                os << (i > 0 ? ", " : "") << '"' << stage_order[i] << "\": {\"seconds\": " << s.seconds << ", \"calls\": " << s.calls << '}';
+            }
+            os << "}, \"counters\": {";
+            for(size_t i(0); i < counter_order.size(); ++i)
+                os << (i > 0 ? ", " : "") << '"' << counter_order[i] << "\": " << counters[counter_order[i]];
+            os << "}}";
+            return os.str();
+        }
+
+    private:
+        struct Stage
+        {
+            double seconds = 0;
+            uint64_t calls = 0;
+        };
+        std::mutex mutex;
+        std::vector<std::string> stage_order;
+        std::map<std::string, Stage> stages;
+        std::vector<std::string> counter_order;
+        std::map<std::string, uint64_t> counters;
+    };
+
+    /**
+     * @brief Access the process-wide Stats object.
+     * @return The Stats object.
+     */
+    inline Stats & stats()
+    {
+        static Stats s;
+        return s;
+    }
+
+    /**
+     * @class Accumulator
+     * @brief Timer that accumulates the time of many short intervals.
+     * @details The time between each call to @ref start() and @ref stop() is
+     * accumulated locally, and the total is added to a stage of the
+     * process-wide @ref Stats object by @ref commit(). This keeps the cost of
+     * timing an interval to two reads of the clock.
+     */
+    class Accumulator
+    {
+    public:
+        /**
+         * @brief Start an interval.
+         * @return void
+         */
+        void start()
+        {
+            begin = std::chrono::steady_clock::now();
+        }
+
+        /**
+         * @brief Stop the current interval and add it to the total.
+         * @return void
+         */
+        void stop()
+        {
+            seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+            ++calls;
+        }
+
+        /**
+         * @brief Add the total to a stage and reset the accumulator.
+         * @param stage The name of the stage.
+         * @return void
+         */
+        void commit(const std::string & stage)
+        {
+            stats().add_time(stage, seconds, calls);
+            seconds = 0;
+            calls = 0;
+        }
+
+    private:
+        std::chrono::steady_clock::time_point begin;
+        double seconds = 0;
+        uint64_t calls = 0;
+    };
+
+    /**
+     * @class ScopedTimer
+     * @brief Timer that adds its lifetime to a stage.
+     */
+    class ScopedTimer
+    {
+    public:
+        /**
+         * @brief Constructor for the ScopedTimer class.
+         * @param stage The name of the stage.
+         */
+        explicit ScopedTimer(const std::string & stage)
+            : stage(stage), begin(std::chrono::steady_clock::now()) {}
+
+        /**
+         * @brief Destructor for the ScopedTimer class.
+         * @details The time since construction is added to the stage.
+         */
+        ~ScopedTimer()
+        {
+            stats().add_time(stage, std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count());
+        }
+
+        ScopedTimer(const ScopedTimer &) = delete;
+        ScopedTimer & operator=(const ScopedTimer &) = delete;
+
+    private:
+        std::string stage;
+        std::chrono::steady_clock::time_point begin;
+    };
+} // namespace sys::timing
+#endif // TIMING_H
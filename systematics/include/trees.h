@@ -12,11 +12,29 @@
 #ifndef TREES_H
 #define TREES_H
 #include <iostream>
+#include <fstream>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <chrono>
+#include <memory>
+#include <exception>
+#include <algorithm>
+#include <functional>
+#include <sstream>
+#include <set>
 
+#include "cache.h"
 #include "detsys.h"
+#include "index.h"
+#include "prefetch.h"
+#include "timing.h"
+#include "weights.h"
 #include "utilities.h"
 #include "configuration.h"
 
+#include "TROOT.h"
 #include "TFile.h"
 #include "TDirectory.h"
 #include "TTree.h"
@@ -40,18 +58,253 @@
 namespace sys::trees
 {
     /**
-     * @brief Type definitions for the selected signal candidates and the
-     * universe weights.
+     * @struct FileResult
+     * @brief Struct to store the matches found in a single CAF file.
+     * @details This struct is used to hand the matches found by a worker
+     * thread back to the thread that fills the output TTrees. The "done" flag
+     * is set once the worker has finished with the file and the "valid" flag
+     * records whether the file could be read at all. The number of bytes
+     * read from the file is recorded for the progress report. The
+     * "fallback" flag records that the entries of the event list did not
+     * describe the file. An exception thrown while matching the file is
+     * stored in "error" and rethrown on the thread that fills the output
+     * TTrees.
      */
-    typedef std::tuple<Double_t, Double_t, Double_t, Double_t> index_t;
-    typedef std::map<index_t, size_t> map_t;
+    struct FileResult
+    {
+        std::vector<Match> matches;
+        bool done = false;
+        bool valid = false;
+        Long64_t bytes = 0;
+        bool fallback = false;
+        std::exception_ptr error;
+    };
+
+    /**
+     * @brief Match the selected signal candidates to the neutrinos in a
+     * single CAF file.
+     * @details This function loops over the neutrino interactions in each
+     * event of a single (opened) CAF file. Each neutrino is looked up in the
+     * index of selected signal candidates and, if a match is found, a @ref Match
+     * is recorded with a copy of the universe weights for each of the
+     * requested weight indices. The function does not touch the input or
+     * output TTrees, so it is safe to call concurrently on different files.
+     * The file is closed and deleted once it has been read.
+     *
+     * If a list of entries is given (from the event list written by the
+     * analysis), only those entries are read. Every listed entry must
+     * contain a selected signal candidate; if one does not, the list does
+     * not describe the file, the whole file is scanned instead, and the
+     * result is flagged (see @ref FileResult) so that the caller can also
+     * check the files that are missing from the list.
+     *
+     * With "all_weights" set, the slots are ignored and the weights of every
+     * weight index of the parent neutrino are copied, with slot i holding
+     * the weights of index i. This is used when filling the match cache (see
+     * @ref MatchCache), so that the cached matches do not depend on the
+     * configured systematics.
+     * @param caf The CAF file as returned by @ref open_caf(). A null pointer
+     * marks an invalid file.
+     * @param candidates The index of selected signal candidates.
+     * @param slots The weight indices to copy (in output order).
+     * @param result The result to which the matches are appended.
+     * @param entries The (sorted, unique) entries of the file to read, or a
+     * null pointer to read every entry.
+     * @param all_weights Whether to copy every weight index instead of the
+     * slots.
+     * @return void
+     */
+    void match_caf(TFile * caf, const sys::index::CandidateIndex & candidates, const std::vector<int64_t> & slots, FileResult & result, const std::vector<Long64_t> * entries = nullptr, bool all_weights = false)
+    {
+        result.valid = caf != nullptr;
+        if(!result.valid)
+            return;
+        std::vector<Match> & matches = result.matches;
+
+        /**
+         * @brief Connect to the input CAF file fields.
+         * @details This block connects to a minimal set of the input CAF file
+         * fields. We need the run, subrun, event, and the true interaction
+         * (parent neutrino) information to match the selected signal
+         * candidates and retrieve the universe weights.
+         */
+        {
+            TTreeReader reader("recTree", caf);
+            TTreeReaderValue<uint32_t> rrun(reader, "rec.hdr.run");
+            TTreeReaderValue<uint32_t> rsubrun(reader, "rec.hdr.subrun");
+            TTreeReaderValue<uint32_t> revt(reader, "rec.hdr.evt");
+            TTreeReaderArray<caf::SRTrueInteraction> mc(reader, "rec.mc.nu");
+
+            /**
+             * @brief Loop over the events in the input CAF file.
+             * @details This block loops over the events in the input CAF file.
+             * The read is done in two phases: the header fields are read
+             * first and the event is skipped unless it contains at least one
+             * selected signal candidate. TTreeReader only reads a branch when
+             * it is first accessed for the current entry, so the true
+             * interaction array (including all of the universe weights) is
+             * only deserialized for events that contain a candidate. For
+             * those events, the code checks if a neutrino interaction from
+             * the input CAF file matches a selected signal candidate. If a
+             * match is found, the universe weights for the parent neutrino
+             * are copied into the match. The time spent in each of these
+             * steps is recorded (see @ref sys::timing::Accumulator).
+             */
+            sys::timing::Accumulator t_next, t_lookup, t_mc, t_copy;
+            uint64_t nevents(0), nselected(0), nchecked(0);
+            size_t next_entry(0);
+            while(true)
+            {
+                t_next.start();
+                bool more(false), unreadable(false);
+                if(entries == nullptr)
+                    more = reader.Next();
+                else if(next_entry < entries->size())
+                {
+                    more = reader.SetEntry((*entries)[next_entry++]) == TTreeReader::kEntryValid;
+                    unreadable = !more;
+                }
+                t_next.stop();
+                if(unreadable)
+                {
+                    std::cerr << "Warning: entry " << (*entries)[next_entry - 1] << " of the event list is not readable in " << caf->GetName() << "; scanning the whole file." << std::endl;
+                    matches.clear();
+                    entries = nullptr;
+                    result.fallback = true;
+                    reader.Restart();
+                    sys::timing::stats().add_count("caf.eventlist_fallbacks", 1);
+                    continue;
+                }
+                if(!more)
+                    break;
+                ++nevents;
+                t_lookup.start();
+                bool selected(candidates.has_event(*rrun, *rsubrun, *revt));
+                t_lookup.stop();
+                if(!selected && entries != nullptr)
+                {
+                    std::cerr << "Warning: entry " << (*entries)[next_entry - 1] << " of the event list does not match " << caf->GetName() << "; scanning the whole file." << std::endl;
+                    matches.clear();
+                    entries = nullptr;
+                    result.fallback = true;
+                    reader.Restart();
+                    sys::timing::stats().add_count("caf.eventlist_fallbacks", 1);
+                    continue;
+                }
+                if(!selected)
+                    continue;
+                ++nselected;
+                t_mc.start();
+                mc.GetSize();
+                t_mc.stop();
+                for(const caf::SRTrueInteraction & nu : mc)
+                {
+                    ++nchecked;
+                    t_lookup.start();
+                    size_t entry(candidates.find(*rrun, *rsubrun, *revt, nu.index));
+                    t_lookup.stop();
+                    if(entry == sys::index::CandidateIndex::npos)
+                        continue;
+                    t_copy.start();
+                    Match m;
+                    m.entry = entry;
+                    m.run = *rrun;
+                    m.subrun = *rsubrun;
+                    m.event = *revt;
+                    m.offsets.push_back(0);
+                    if(all_weights)
+                    {
+                        for(size_t s(0); s < nu.wgt.size(); ++s)
+                        {
+                            m.weights.insert(m.weights.end(), nu.wgt[s].univ.begin(), nu.wgt[s].univ.end());
+                            m.offsets.push_back(m.weights.size());
+                        }
+                    }
+                    else
+                    {
+                        for(const int64_t & s : slots)
+                        {
+                            m.weights.insert(m.weights.end(), nu.wgt[s].univ.begin(), nu.wgt[s].univ.end());
+                            m.offsets.push_back(m.weights.size());
+                        }
+                    }
+                    matches.push_back(std::move(m));
+                    t_copy.stop();
+                } // End of loop over the neutrino interactions in the input CAF file.
+            } // End of loop over the events in the input CAF file.
+            t_next.commit("caf.next");
+            t_lookup.commit("caf.lookup");
+            t_mc.commit("caf.read_mc");
+            t_copy.commit("caf.copy_weights");
+            sys::timing::stats().add_count("caf.events", nevents);
+            sys::timing::stats().add_count("caf.selected_events", nselected);
+            sys::timing::stats().add_count("caf.neutrinos_checked", nchecked);
+            sys::timing::stats().add_count("caf.matches", matches.size());
+        }
+        result.bytes = caf->GetBytesRead();
+        sys::timing::stats().add_count("caf.files", 1);
+        sys::timing::stats().add_count("caf.bytes_read", result.bytes);
+        caf->Close();
+        delete caf;
+    }
+
+    /**
+     * @brief Bound the memory held by the baskets of an output TTree.
+     * @details This function configures a TTree that is attached to an output
+     * file for streaming: the baskets of all branches are flushed to disk
+     * (completing a cluster) whenever more than the specified number of bytes
+     * have been filled, and the TTree header is saved periodically so that
+     * a partially written file remains readable. The basket size of each
+     * branch is set to an equal share of the budget, so the memory held in
+     * unflushed baskets stays close to the budget regardless of the number
+     * of entries. ROOT grows a basket if it cannot hold a single entry.
+     * @param tree The TTree to configure.
+     * @param directory The output directory to which the TTree is attached.
+     * @param bytes The memory budget of the TTree in bytes.
+     * @return void
+     */
+    inline void set_memory_budget(TTree * tree, TDirectory * directory, Long64_t bytes)
+    {
+        tree->SetDirectory(directory);
+        tree->SetAutoFlush(-bytes);
+        tree->SetAutoSave(-4 * bytes);
+        Long64_t nbranches(std::max<Long64_t>(tree->GetListOfBranches()->GetEntries(), 1));
+        tree->SetBasketSize("*", static_cast<Int_t>(std::clamp<Long64_t>(bytes / nbranches, 4096, 16 * 1024 * 1024)));
+    }
+
+    /**
+     * @brief Read the number of universes of each weight index from the CAF
+     * header.
+     * @details The "globalTree" of a CAF file records the weight parameter
+     * sets of the file ("global.wgts"), including the number of universes
+     * ("nuni") of each, in the order of the weight indices of the neutrinos.
+     * @param path The path of the CAF file.
+     * @return the number of universes of each weight index, or an empty
+     * vector if the header cannot be read.
+     */
+    inline std::vector<int64_t> read_universe_counts(const std::string & path)
+    {
+        std::vector<int64_t> counts;
+        std::unique_ptr<TFile> caf(TFile::Open(path.c_str(), "READ"));
+        if(!caf || caf->IsZombie() || caf->Get<TTree>("globalTree") == nullptr)
+            return counts;
+        TTreeReader reader("globalTree", caf.get());
+        TTreeReaderArray<int> nuni(reader, "global.wgts.nuni");
+        if(reader.Next())
+        {
+            for(size_t i(0); i < nuni.GetSize(); ++i)
+                counts.push_back(nuni[i]);
+        }
+        return counts;
+    }
 
     /**
      * @brief Copy the input TTree to the output TTree.
-     * @details This function copies the input TTree to the output TTree. The
-     * function loops over the input TTree and copies the values of the branches
-     * to the output TTree. The output TTree is created with the same branches
-     * as the input TTree.
+     * @details This function copies the input TTree to the output TTree. By
+     * default, the input TTree is fast-cloned (basket-by-basket) into the
+     * output directory. Otherwise, the function loops over the input TTree and
+     * copies the values of the branches to the output TTree. The output TTree
+     * is created with the same branches as the input TTree.
      * @param table The table that contains the configuration for the tree.
      * @param output The output TFile.
      * @param input The input TFile.
@@ -67,6 +320,25 @@ namespace sys::trees
         directory = create_directory(directory, table.get_string_field("destination").c_str());
         directory->cd();
         
+        /**
+         * @brief Fast-clone the input TTree into the output directory.
+         * @details Unless disabled by setting the optional "fast_clone" field
+         * of the tree table to false, the input TTree is cloned with the
+         * "fast" option. This copies the compressed baskets directly without
+         * decompressing and re-compressing each entry, so the copy is limited
+         * by I/O rather than CPU. The clone is created in the current
+         * directory, which is the configured destination.
+         */
+        TTree * input_tree = (TTree *) input->Get(table.get_string_field("origin").c_str());
+        if(!table.has_field("fast_clone") || table.get_bool_field("fast_clone"))
+        {
+            TTree * output_tree = input_tree->CloneTree(-1, "fast");
+            output_tree->SetName(table.get_string_field("name").c_str());
+            output_tree->SetTitle(table.get_string_field("name").c_str());
+            directory->WriteObject(output_tree, table.get_string_field("name").c_str());
+            return;
+        }
+
         /**
          * @brief Create the output TTree with the name specified in the
          * configuration file.
@@ -81,7 +353,6 @@ namespace sys::trees
          * a single array to store the values of the double branches and three
          * separate variables to store the values of the int branches.
          */
-        TTree * input_tree = (TTree *) input->Get(table.get_string_field("origin").c_str());
         int run, subrun, event;
         double br[input_tree->GetNbranches()-3];
         for (int i = 0; i < input_tree->GetNbranches()-3; i++)
@@ -132,9 +403,10 @@ namespace sys::trees
      * @param table The table that contains the configuration for the tree.
      * @param output The output TFile.
      * @param input The input TFile.
+     * @param detsys The calculators of the detector systematics.
      * @return void
      */
-    void copy_with_weight_systematics(sys::cfg::ConfigurationTable & config, sys::cfg::ConfigurationTable & table, TFile * output, TFile * input, sys::detsys::DetsysCalculator & calc)
+    void copy_with_weight_systematics(sys::cfg::ConfigurationTable & config, sys::cfg::ConfigurationTable & table, TFile * output, TFile * input, sys::detsys::DetsysRegistry & detsys)
     {
         /**
          * @brief Create the output subdirectory following the nesting outlined
@@ -189,19 +461,36 @@ namespace sys::trees
         output_tree->Branch("Evt", &event);
         
         /**
-         * @brief Create the map of selected signal candidates.
-         * @details This block creates a map of selected signal candidates. The
-         * map is built by looping over the input TTree and storing the index
-         * (run, subrun, event, nu_id) of the selected signal candidates in the
-         * map. The index is used to match the selected signal candidates with
-         * the universe weights for the parent neutrino.
+         * @brief Create the index of selected signal candidates.
+         * @details This block creates an index of selected signal candidates.
+         * The index is built by looping over the input TTree and storing the
+         * (run, subrun, event, nu_id) of the selected signal candidates, as
+         * well as the set of events that contain at least one candidate. The
+         * index is used to match the selected signal candidates with the
+         * universe weights for the parent neutrino. Only the four key
+         * branches are read while building the index. A checksum of the keys
+         * (an FNV-1a hash of the packed keys) is accumulated for the key of
+         * the match cache.
          */
-        map_t candidates;
+        sys::timing::Accumulator t_index;
+        t_index.start();
+        sys::index::CandidateIndex candidates;
+        candidates.reserve(input_tree->GetEntries());
+        uint64_t checksum(fnv1a(nullptr, 0));
+        input_tree->SetBranchStatus("*", 0);
+        for(const char * br : {"nu_id", "Run", "Subrun", "Evt"})
+            input_tree->SetBranchStatus(br, 1);
         for(int i(0); i < input_tree->GetEntries(); ++i)
         {
             input_tree->GetEntry(i);
-            candidates.insert(std::make_pair<index_t, size_t>(std::make_tuple(run, subrun, event, nu_id), i));
+            candidates.insert(run, subrun, event, static_cast<int64_t>(nu_id), i);
+            sys::index::Key k(sys::index::pack(run, subrun, event, static_cast<int64_t>(nu_id)));
+            checksum = fnv1a(&k, sizeof(k), checksum);
         }
+        input_tree->SetBranchStatus("*", 1);
+        t_index.stop();
+        t_index.commit("index.build");
+        sys::timing::stats().add_count("index.candidates", input_tree->GetEntries());
 
         /**
          * @brief Configure the weight-based systematics.
@@ -217,14 +506,37 @@ namespace sys::trees
          * name of the systematic parameter to its index within the input
          * weights. The variable "systrees" is a map that serves as a container
          * for the output TTrees of each systematic type keyed by the name of
-         * the type. The variable "weights" is a map with a key of the index of
-         * the systematic parameter and a value of std::vector<double>* that is
-         * used to connect the universe weights to the output TTree.
+         * the type. The variable "branches" holds a @ref WeightBranch (a
+         * fixed-size array branch) for each systematic parameter in
+         * configuration order, "branch_index" holds the corresponding index
+         * of the systematic parameter (negative for detector systematics),
+         * and "branch_width" holds the configured number of universes of the
+         * parameter (the optional "nuniverses" field of a weight-based
+         * systematic, or zero if it is to be read from the CAF header). The
+         * position of the weights of each index within a @ref Match is
+         * recorded later in "slot_of". The storage format of the weights is
+         * set by the optional "output.weight_format" field, and the quantum
+         * of the "int16" format by the optional "output.weight_quantum"
+         * field. The detector systematics (type
+         * "variation") are instead resolved to a @ref DetsysSlot for each
+         * binning variable of the registry, so the per-candidate evaluation
+         * needs no string lookups.
          */
+        struct DetsysSlot
+        {
+            size_t calc;
+            size_t handle;
+            const double * value;
+        };
+        std::map<int64_t, DetsysSlot> detsys_slots;
         std::vector<std::vector<sys::cfg::ConfigurationTable>> systables;
         std::map<std::string, int64_t> systs;
         std::map<std::string, TTree *> systrees;
-        std::map<int64_t, std::vector<double>*> weights;
+        std::vector<WeightBranch> branches;
+        std::vector<int64_t> branch_index;
+        std::vector<size_t> branch_width;
+        WeightFormat format(get_weight_format(config));
+        double quantum(config.has_field("output.weight_quantum") ? config.get_double_field("output.weight_quantum") : 1.0 / 4096);
         
         /**
          * @brief Loop over the systematic types in the configuration file.
@@ -255,23 +567,32 @@ namespace sys::trees
              * type as defined by the configuration file. The loop "flattens"
              * the systematics into a single set of maps for use below in the
              * loop over the input CAF files. The TTree of each systematic type
-             * is extended with a vector of doubles for each systematic
-             * parameter belonging to the type.
+             * is extended with a fixed-size array of weights for each
+             * systematic parameter belonging to the type. Unless configured,
+             * the arrays are sized (and the branches created) when the first
+             * matched candidates are filled.
              */
             for(sys::cfg::ConfigurationTable & t : systables.back())
             {
                 if(type != "variation")
                 {
                     systs.insert(std::make_pair<std::string, int64_t>(t.get_string_field("name"), t.get_int_field("index")));
-                    weights.insert(std::make_pair<int64_t, std::vector<double>*>(t.get_int_field("index"), new std::vector<double>));
-                    systrees[s]->Branch(t.get_string_field("name").c_str(), &weights[t.get_int_field("index")]);
+                    branch_index.push_back(t.get_int_field("index"));
+                    branch_width.push_back(t.has_field("nuniverses") ? t.get_int_field("nuniverses", 1) : 0);
+                    branches.emplace_back(systrees[s], t.get_string_field("name"), format, quantum);
                 }
                 else if(type == "variation")
                 {
-                    systs.insert(std::make_pair<std::string, int64_t>(t.get_string_field("name"), std::move(variation_counter)));
-                    weights.insert(std::make_pair<int64_t, std::vector<double>*>(std::move(variation_counter), new std::vector<double>));
-                    systrees[s]->Branch(t.get_string_field("name").c_str(), &weights[variation_counter]);
-                    --variation_counter;
+                    if(detsys.size() == 0)
+                        throw sys::cfg::ConfigurationError("Systematic " + t.get_string_field("name") + " of type variation requires a [variations] block.");
+                    for(size_t c(0); c < detsys.size(); ++c)
+                    {
+                        detsys_slots[variation_counter] = {c, detsys[c].get_handle(t.get_string_field("name")), &brs[detsys[c].get_variable()]};
+                        branch_index.push_back(variation_counter);
+                        branch_width.push_back(0);
+                        --variation_counter;
+                        branches.emplace_back(systrees[s], detsys.get_branch_name(c, t.get_string_field("name")), format, quantum);
+                    }
                 }
             }
         }
@@ -282,119 +603,513 @@ namespace sys::trees
          * are specified in a file list that is read from the configuration
          * file. The file list is read line-by-line and the input CAF files are
          * stored in a vector.
+         *
+         * With the optional "input.eventlist" field set, the event list
+         * written by the analysis next to the input TTree (the TTree
+         * "<origin>_eventlist") is used instead, if it exists. Only the CAF
+         * files that contain a selected signal candidate are opened, and only
+         * the listed entries of each file are read. The event list is only
+         * used if it has a row for every selected signal candidate;
+         * otherwise every file of the CAF file list is read.
          */
         std::vector<std::string> input_files;
-        std::ifstream file_list(config.get_string_field("input.caflist"));
-        std::string line;
-        while(std::getline(file_list, line))
-            input_files.push_back(line);
-        file_list.close();
+        std::vector<std::vector<Long64_t>> file_entries;
+        TTree * eventlist(nullptr);
+        if(config.has_field("input.eventlist") && config.get_bool_field("input.eventlist"))
+        {
+            eventlist = input->Get<TTree>((table.get_string_field("origin") + "_eventlist").c_str());
+            if(eventlist == nullptr)
+                std::cerr << "Warning: no event list found for " << table.get_string_field("origin") << "; reading every file of the CAF file list." << std::endl;
+        }
+        if(eventlist != nullptr)
+        {
+            std::string * path(nullptr);
+            Long64_t entry, list_nu_id;
+            Int_t list_run, list_subrun, list_evt;
+            eventlist->SetBranchAddress("file", &path);
+            eventlist->SetBranchAddress("entry", &entry);
+            eventlist->SetBranchAddress("run", &list_run);
+            eventlist->SetBranchAddress("subrun", &list_subrun);
+            eventlist->SetBranchAddress("evt", &list_evt);
+            eventlist->SetBranchAddress("nu_id", &list_nu_id);
+            std::map<std::string, size_t> file_index;
+            std::vector<bool> covered(input_tree->GetEntries(), false);
+            for(Long64_t i(0); i < eventlist->GetEntries(); ++i)
+            {
+                eventlist->GetEntry(i);
+                size_t c(candidates.find(list_run, list_subrun, list_evt, list_nu_id));
+                if(c != sys::index::CandidateIndex::npos)
+                    covered[c] = true;
+                auto [it, inserted] = file_index.try_emplace(*path, input_files.size());
+                if(inserted)
+                {
+                    input_files.push_back(*path);
+                    file_entries.emplace_back();
+                }
+                file_entries[it->second].push_back(entry);
+            }
+            for(std::vector<Long64_t> & e : file_entries)
+            {
+                std::sort(e.begin(), e.end());
+                e.erase(std::unique(e.begin(), e.end()), e.end());
+            }
+            eventlist->ResetBranchAddresses();
+            delete path;
+            if(std::find(covered.begin(), covered.end(), false) != covered.end())
+            {
+                std::cerr << "Warning: the event list of " << table.get_string_field("origin") << " does not cover every selected candidate; reading every file of the CAF file list." << std::endl;
+                input_files.clear();
+                file_entries.clear();
+                eventlist = nullptr;
+            }
+            else
+                std::cout << "Using the event list of " << table.get_string_field("origin") << ": " << input_files.size() << " files." << std::endl;
+        }
+        if(eventlist == nullptr)
+        {
+            std::ifstream file_list(config.get_string_field("input.caflist"));
+            std::string line;
+            while(std::getline(file_list, line))
+                input_files.push_back(line);
+            file_list.close();
+        }
+        auto get_entries = [&](size_t i) -> const std::vector<Long64_t> *
+        {
+            return file_entries.empty() ? nullptr : &file_entries[i];
+        };
+
+        /**
+         * @brief Open the optional match cache.
+         * @details With the optional "input.cache" field set to the path of
+         * a cache file, the matches of the selected signal candidates are
+         * kept in the cache file (see @ref MatchCache). The key of the cache
+         * covers the input file, the number and the checksum of the selected
+         * signal candidates, and the path, size, and modification time of
+         * each CAF file to be read, but not the configured systematics. If
+         * the cache holds valid matches for the key, the CAF files are not
+         * read at all; otherwise the CAF files are matched as usual and the
+         * matches are recorded in the cache. The matches are not committed
+         * if the event list was found to be inconsistent, as some of them
+         * may then come from CAF files that are not covered by the key.
+         */
+        std::unique_ptr<MatchCache> cache;
+        if(config.has_field("input.cache"))
+        {
+            std::ostringstream key;
+            key << "v2;" << describe_file(input->GetName()) << ";" << table.get_string_field("origin") << ";" << input_tree->GetEntries() << ";" << checksum;
+            for(const std::string & f : input_files)
+                key << ";" << describe_file(f);
+            cache = std::make_unique<MatchCache>(config.get_string_field("input.cache"), table.get_string_field("origin"), cache_key(key.str()));
+            directory->cd();
+            std::cout << (cache->is_valid() ? "Using" : "Filling") << " the match cache of " << table.get_string_field("origin") << "." << std::endl;
+        }
+        bool replay(cache && cache->is_valid());
+
+        /**
+         * @brief Assign each weight-based systematic a slot in the matches.
+         * @details The workers copy the universe weights of every matched
+         * neutrino into a @ref Match, one vector per weight-based systematic.
+         * This block records the order of these vectors so that the weights
+         * can be connected back to the output branches when filling. With
+         * the match cache, every weight index is copied and the slot of each
+         * systematic is its weight index.
+         */
+        std::vector<int64_t> slots;
+        std::map<int64_t, size_t> slot_of;
+        for(auto & [key, value] : systs)
+        {
+            if(value >= 0)
+            {
+                slot_of[value] = cache ? value : slots.size();
+                slots.push_back(value);
+            }
+        }
+
+        std::vector<double> detsys_weights;
+
+        /**
+         * @brief Configure the optional streaming mode.
+         * @details With the optional "output.streaming" field set, the output
+         * TTrees are written to disk incrementally with bounded basket memory
+         * (see @ref set_memory_budget()). The optional "output.memory_budget"
+         * field sets the total budget (in MB, default 256) that is shared
+         * equally by the output TTree and the systematic TTrees. The TTrees
+         * are configured once all of their branches exist, i.e. when the
+         * first candidate is matched (or after the loop if none are).
+         */
+        bool streaming(config.has_field("output.streaming") && config.get_bool_field("output.streaming"));
+        Long64_t budget((config.has_field("output.memory_budget") ? config.get_int_field("output.memory_budget", 1) : 256) * 1024 * 1024);
+        bool configured(!streaming);
+        auto configure_streaming = [&]()
+        {
+            Long64_t share(budget / static_cast<Long64_t>(systrees.size() + 1));
+            set_memory_budget(output_tree, directory, share);
+            for(auto & [key, value] : systrees)
+                set_memory_budget(value, directory, share);
+            configured = true;
+        };
+
+        /**
+         * @brief Get the number of universes of a systematic parameter.
+         * @details The width of a detector systematic is the number of
+         * configured z-scores. The width of a weight-based systematic is the
+         * configured "nuniverses", if any, and otherwise the number of
+         * universes of its weight index in the header of the first CAF file
+         * (see @ref read_universe_counts()). The width is never inferred
+         * from the matches, as a later neutrino with more universes could
+         * not be stored.
+         * @throw sys::cfg::ConfigurationError if the width of a weight-based
+         * systematic is neither configured nor in the CAF header.
+         */
+        std::vector<int64_t> header_width;
+        bool header_read(false);
+        auto get_width = [&](size_t i) -> size_t
+        {
+            int64_t value(branch_index[i]);
+            if(value < 0)
+                return detsys[detsys_slots[value].calc].get_zscores(detsys_slots[value].handle).size();
+            if(branch_width[i] > 0)
+                return branch_width[i];
+            if(!header_read && !input_files.empty())
+                header_width = read_universe_counts(input_files.front());
+            header_read = true;
+            if(input_files.empty())
+                return 1;
+            if(value >= static_cast<int64_t>(header_width.size()) || header_width[value] <= 0)
+                throw sys::cfg::ConfigurationError("The number of universes of systematic " + branches[i].get_name() + " is not configured and cannot be read from the header of " + input_files.front() + ". Set its \"nuniverses\" field.");
+            return header_width[value];
+        };
+
+        /**
+         * @brief Fill the output TTrees with the matches from a single file.
+         * @details This lambda fills the output TTrees with the matched signal
+         * candidates from a single CAF file. The selected signal candidate is
+         * retrieved from the input TTree and its values are copied to the
+         * output TTree. The universe weights are then stored in the output
+         * TTree for each of the configured systematics. Weight branches that
+         * do not exist yet are created with the first batch of matches (see
+         * get_width above). This is always done on the calling thread, as
+         * neither the input TTree, the output TTrees, nor the
+         * DetsysCalculators are thread-safe. The time spent
+         * reading the input TTree, copying the weights, evaluating the
+         * detector systematics, and filling the output TTrees is recorded
+         * (see @ref sys::timing::Accumulator).
+         */
+        sys::timing::Accumulator t_input, t_weights, t_detsys, t_fill;
+        std::vector<bool> matched(input_tree->GetEntries(), false);
+        bool fallback(false);
+        auto fill = [&](std::vector<Match> & matches)
+        {
+            for(size_t i(0); i < branches.size() && !matches.empty(); ++i)
+            {
+                if(!branches[i].is_created())
+                    branches[i].create(get_width(i));
+            }
+            for(Match & m : matches)
+            {
+                matched[m.entry] = true;
+                detsys.increment_nominal_count(1.0);
+                t_input.start();
+                input_tree->GetEntry(m.entry);
+                t_input.stop();
+                run = m.run;
+                subrun = m.subrun;
+                event = m.event;
+
+                for(size_t i(0); i < branches.size(); ++i)
+                {
+                    int64_t value(branch_index[i]);
+                    if(value >= 0)
+                    {
+                        t_weights.start();
+                        size_t slot(slot_of[value]);
+                        if(slot + 1 >= m.offsets.size())
+                            throw sys::cfg::ConfigurationError("Weight index " + std::to_string(value) + " is not present in the matched neutrino.");
+                        branches[i].set(&m.weights[m.offsets[slot]], m.offsets[slot + 1] - m.offsets[slot]);
+                        t_weights.stop();
+                    }
+                    else
+                    {
+                        t_detsys.start();
+                        const DetsysSlot & d(detsys_slots[value]);
+                        sys::detsys::DetsysCalculator & calc(detsys[d.calc]);
+                        detsys_weights.resize(calc.get_zscores(d.handle).size());
+                        calc.get_weights(d.handle, *d.value, detsys_weights.data());
+                        branches[i].set(detsys_weights.data(), detsys_weights.size());
+                        calc.add_value(d.handle, *d.value);
+                        t_detsys.stop();
+                    }
+                } // End of loop over the configured systematics.
+                if(!configured)
+                    configure_streaming();
+                t_fill.start();
+                output_tree->Fill();
+                for(auto & [key, value] : systrees)
+                    value->Fill();
+                t_fill.stop();
+            }
+            sys::timing::stats().add_count("fill.candidates", matches.size());
+        };
+
+        /**
+         * @brief Configure the opening of the input CAF files.
+         * @details The optional "input.prefetch" field sets the number of
+         * files that are opened and warmed ahead of the matching by a
+         * background thread (see @ref Prefetcher). The default of zero opens
+         * each file only when it is needed. The optional "input.cache_size"
+         * field sets the size of the TTreeCache (in MB) of each file.
+         */
+        size_t nthreads(config.has_field("input.threads") ? config.get_int_field("input.threads", 1) : 1);
+        size_t nprefetch(config.has_field("input.prefetch") ? config.get_int_field("input.prefetch", 0) : 0);
+        Long64_t cache_size((config.has_field("input.cache_size") ? config.get_int_field("input.cache_size", 0) : 32) * 1024 * 1024);
+        if(nthreads > 1 || nprefetch > 0)
+            ROOT::EnableThreadSafety();
+        std::unique_ptr<Prefetcher> prefetcher(nprefetch > 0 && !replay ? new Prefetcher(input_files, nprefetch, cache_size) : nullptr);
+        auto get_file = [&](size_t i) -> TFile *
+        {
+            sys::timing::ScopedTimer timer("caf.open");
+            return prefetcher ? prefetcher->take(i) : open_caf(input_files[i], cache_size, false);
+        };
+
+        /**
+         * @brief Report the progress of the loop over the input CAF files.
+         * @details Every 100 files, the number of processed files is printed
+         * along with the average rate of files and of bytes read from the
+         * CAF files.
+         */
+        auto start = std::chrono::steady_clock::now();
+        Long64_t total_bytes(0);
+        auto report = [&](size_t nprocessed)
+        {
+            if(nprocessed % 100 != 0)
+                return;
+            double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            std::cout << "Processed " << nprocessed << " files";
+            if(nprocessed > 0 && elapsed > 0)
+                std::cout << " (" << nprocessed / elapsed << " files/s, " << total_bytes / elapsed / (1024 * 1024) << " MB/s)";
+            std::cout << "." << std::endl;
+        };
 
         /**
          * @brief Loop over the input CAF files.
          * @details This block loops over the input CAF files. This loop begins
-         * the process of matching the selected signal candidates with the universe
-         * weights for parent neutrino. 
+         * the process of matching the selected signal candidates with the
+         * universe weights for parent neutrino. The number of worker threads
+         * is set by the optional "input.threads" field. With a single thread,
+         * each file is matched and filled in turn. With multiple threads, the
+         * files are handed out to the workers in order and the matches are
+         * filled on this thread strictly in the order of the file list, so the
+         * output is identical regardless of the number of threads. Workers may
+         * run at most a fixed window of files ahead of the filling to bound the
+         * memory held in unfilled matches. An exception thrown by a worker is
+         * handed back with its file and rethrown here; on any exception, the
+         * workers are stopped and joined before it propagates.
+         *
+         * If the match cache is valid, the cached matches are filled instead
+         * and no CAF file is opened. Otherwise the matches of each file are
+         * recorded in the cache as they are filled, and the cache is
+         * committed once every file has been processed.
          */
-        size_t nprocessed(0);
-        for(std::string input_file : input_files)
+        if(replay)
         {
-            if(nprocessed % 100 == 0)
-                std::cout << "Processed " << nprocessed << " files." << std::endl;
-            /**
-             * @brief Open and validate the input CAF file.
-             * @details This block opens the input CAF file and checks that the
-             * files is not a zombie (corrupted) and that it contains the TTree
-             * "recTree". If the file is a zombie or does not contain the TTree,
-             * the code prints an error message and continues to the next file.
-             * Practically, skipping a file means that signal events from that file
-             * will not be included in the output ROOT file, though a situation
-             * where this occurs is not expected.
-             */
-            TFile * caf = TFile::Open(input_file.c_str(), "READ");
-            if(caf->IsZombie() || !caf->GetListOfKeys()->Contains("recTree"))
+            sys::timing::ScopedTimer timer("cache.replay");
+            size_t n(cache->replay(fill));
+            sys::timing::stats().add_count("cache.matches", n);
+        }
+        else if(nthreads <= 1)
+        {
+            for(size_t nprocessed(0); nprocessed < input_files.size(); ++nprocessed)
             {
-                std::cerr << "Error: File" << input_file << " does not exist." << std::endl;
-                continue;
+                report(nprocessed);
+                FileResult r;
+                match_caf(get_file(nprocessed), candidates, slots, r, get_entries(nprocessed), cache != nullptr);
+                total_bytes += r.bytes;
+                fallback = fallback || r.fallback;
+                if(r.valid)
+                {
+                    if(cache)
+                        cache->record(r.matches);
+                    fill(r.matches);
+                }
             }
+        }
+        else
+        {
+            const size_t window(4 * nthreads);
+            std::vector<FileResult> results(input_files.size());
+            std::atomic<size_t> next_file(0);
+            size_t next_fill(0);
+            bool stop(false);
+            std::mutex mutex;
+            std::condition_variable cv;
 
-            /**
-             * @brief Connect to the input CAF file fields.
-             * @details This block connects to a minimal set of the input CAF file
-             * fields. We need the run, subrun, event, and the true interaction
-             * (parent neutrino) information to match the selected signal
-             * candidates and retrieve the universe weights.
-             */
-            TTreeReader reader("recTree", caf);
-            TTreeReaderValue<uint32_t> rrun(reader, "rec.hdr.run");
-            TTreeReaderValue<uint32_t> rsubrun(reader, "rec.hdr.subrun");
-            TTreeReaderValue<uint32_t> revt(reader, "rec.hdr.evt");
-            TTreeReaderArray<caf::SRTrueInteraction> mc(reader, "rec.mc.nu");
+            auto work = [&]()
+            {
+                for(size_t i(next_file++); i < input_files.size(); i = next_file++)
+                {
+                    {
+                        std::unique_lock<std::mutex> lock(mutex);
+                        cv.wait(lock, [&]{ return stop || i < next_fill + window; });
+                        if(stop)
+                            return;
+                    }
+                    FileResult r;
+                    try
+                    {
+                        match_caf(get_file(i), candidates, slots, r, get_entries(i), cache != nullptr);
+                    }
+                    catch(...)
+                    {
+                        r.error = std::current_exception();
+                    }
+                    r.done = true;
+                    {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        results[i] = std::move(r);
+                    }
+                    cv.notify_all();
+                }
+            };
 
             /**
-             * @brief Loop over the events in the input CAF file.
-             * @details This block loops over the events in the input CAF file. At
-             * each event, the code checks if a neutrino interaction from the input
-             * CAF file matches a selected signal candidate. If a match is found,
-             * the code retrieves the universe weights for the parent neutrino and
-             * stores them in the output TTree.
+             * @brief Stop and join the workers when leaving this block.
+             * @details The joiner is destroyed both after the last file has
+             * been filled and while an exception propagates, so a worker is
+             * never left joinable.
              */
-            while(reader.Next())
+            std::vector<std::thread> workers;
+            struct Joiner
             {
-                for(const caf::SRTrueInteraction & nu : mc)
+                std::vector<std::thread> & workers;
+                bool & stop;
+                std::mutex & mutex;
+                std::condition_variable & cv;
+                ~Joiner()
                 {
-                    index_t index(*rrun, *rsubrun, *revt, nu.index);
-                    if(candidates.find(index) != candidates.end())
                     {
-                        calc.increment_nominal_count(1.0);
-                        /**
-                         * @brief Retrieve the selected signal candidate and copy
-                         * the values to the output TTree.
-                         * @details This block retrieves the selected signal
-                         * candidate that has been matched with the parent neutrino
-                         * and copies the values to the output TTree.
-                         */
-                        input_tree->GetEntry(candidates[index]);
-                        run = *rrun;
-                        subrun = *rsubrun;
-                        event = *revt;
-                        output_tree->Fill();
-                        
-                        /**
-                         * @brief Store the universe weights in the output TTree.
-                         * @details This block stores the universe weights in the
-                         * output TTree for each of the configured systematics.  
-                         */
-                        for(auto & [key, value] : systs)
-                        {
-                            if(value >= 0)
-                            {
-                                weights[value]->clear();
-                                for(size_t u(0); u < nu.wgt[value].univ.size(); ++u)
-                                    weights[value]->push_back(nu.wgt[value].univ[u]);
-                            }
-                            else
-                            {
-                                weights[value]->clear();
-                                for(double & z : calc.get_zscores(key))
-                                    weights[value]->push_back(calc.get_weight(key, brs[calc.get_variable()], z));
-                                calc.add_value(key, brs[calc.get_variable()]);
-                            }
-                        } // End of loop over the configured systematics.
-                        for(auto & [key, value] : systrees)
-                            value->Fill();
+                        std::lock_guard<std::mutex> lock(mutex);
+                        stop = true;
                     }
-                } // End of loop over the neutrino interactions in the input CAF file.
-            } // End of loop over the events in the input CAF file.
-            caf->Close();
-            nprocessed++;
+                    cv.notify_all();
+                    for(std::thread & w : workers)
+                        w.join();
+                }
+            } joiner{workers, stop, mutex, cv};
+            for(size_t t(0); t < nthreads; ++t)
+                workers.emplace_back(work);
+
+            for(size_t nprocessed(0); nprocessed < input_files.size(); ++nprocessed)
+            {
+                report(nprocessed);
+                FileResult r;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    cv.wait(lock, [&]{ return results[nprocessed].done; });
+                    r = std::move(results[nprocessed]);
+                    next_fill = nprocessed + 1;
+                }
+                cv.notify_all();
+                if(r.error)
+                    std::rethrow_exception(r.error);
+                total_bytes += r.bytes;
+                fallback = fallback || r.fallback;
+                if(r.valid)
+                {
+                    if(cache)
+                        cache->record(r.matches);
+                    fill(r.matches);
+                }
+            }
         } // End of loop over the input CAF files.
+
+        /**
+         * @brief Recover the candidates missed by an inconsistent event list.
+         * @details If the entries of the event list did not describe one of
+         * its files, the file names of the list may be wrong for other files
+         * as well, so the candidates that remain unmatched are looked for in
+         * the files of the CAF file list that are missing from the event
+         * list.
+         */
+        if(fallback && !file_entries.empty())
+        {
+            std::cerr << "Warning: the event list of " << table.get_string_field("origin") << " is inconsistent with the CAF files; searching the rest of the CAF file list for the unmatched candidates." << std::endl;
+            sys::index::CandidateIndex missing;
+            input_tree->SetBranchStatus("*", 0);
+            for(const char * br : {"nu_id", "Run", "Subrun", "Evt"})
+                input_tree->SetBranchStatus(br, 1);
+            for(Long64_t i(0); i < input_tree->GetEntries(); ++i)
+            {
+                if(matched[i])
+                    continue;
+                input_tree->GetEntry(i);
+                missing.insert(run, subrun, event, static_cast<int64_t>(nu_id), i);
+            }
+            input_tree->SetBranchStatus("*", 1);
+            std::set<std::string> listed(input_files.begin(), input_files.end());
+            std::ifstream file_list(config.get_string_field("input.caflist"));
+            for(std::string line; std::getline(file_list, line);)
+            {
+                if(listed.count(line) != 0)
+                    continue;
+                FileResult r;
+                match_caf(open_caf(line, cache_size, false), missing, slots, r, nullptr, cache != nullptr);
+                sys::timing::stats().add_count("caf.eventlist_rescans", 1);
+                if(r.valid)
+                {
+                    if(cache)
+                        cache->record(r.matches);
+                    fill(r.matches);
+                }
+            }
+        }
+        if(cache && !replay && fallback)
+            std::cerr << "Warning: the match cache of " << table.get_string_field("origin") << " is not committed, as the event list was inconsistent." << std::endl;
+        else if(cache && !replay)
+        {
+            cache->commit();
+            directory->cd();
+        }
+
+        /**
+         * @brief Create any weight branches that were never filled.
+         * @details If no candidate was matched, the weight branches have not
+         * been created. They are created here so that the layout of the
+         * output TTrees does not depend on the input.
+         */
+        for(size_t i(0); i < branches.size(); ++i)
+        {
+            if(!branches[i].is_created())
+                branches[i].create(get_width(i));
+        }
+
+        /**
+         * @brief Report the weights that could not be stored as matched.
+         * @details Neutrinos without universes for a parameter are stored
+         * with unit weights, and weights outside of the range of the "int16"
+         * format are saturated. Both are counted per branch and reported.
+         */
+        for(const WeightBranch & b : branches)
+        {
+            if(b.get_empty() > 0)
+                std::cerr << "Warning: " << b.get_empty() << " entries of branch " << b.get_name() << " had no universes and were stored with unit weights." << std::endl;
+            if(b.get_saturated() > 0)
+                std::cerr << "Warning: " << b.get_saturated() << " weights of branch " << b.get_name() << " were outside of the range of the int16 format and were saturated." << std::endl;
+            sys::timing::stats().add_count("weights.empty", b.get_empty());
+            sys::timing::stats().add_count("weights.saturated", b.get_saturated());
+        }
+        if(!configured)
+            configure_streaming();
+        t_input.commit("fill.input");
+        t_weights.commit("fill.weights");
+        t_detsys.commit("fill.detsys");
+        t_fill.commit("fill.tree");
+        sys::timing::ScopedTimer timer("write.trees");
         directory->WriteObject(output_tree, table.get_string_field("name").c_str());
         for(auto & [key, value] : systrees)
             directory->WriteObject(value, (key+"Tree").c_str());
         
         // Write detector systematic histograms to the output file.
-        calc.write_results();
+        detsys.write_results();
     }
 }
 #endif
\ No newline at end of file
@@ -0,0 +1,201 @@
+/**
+ * @file weights.h
+ * @brief Header and implementation of the WeightBranch class.
+ * @details This file contains the header and implementation of the
+ * WeightBranch class. The WeightBranch class manages a single fixed-size
+ * array branch of universe weights in one of the systematic TTrees. The
+ * weights may be stored as doubles, as floats, or as 16-bit quantized
+ * deltas from one.
+ * @author mueller@fnal.gov
+ */
+#ifndef WEIGHTS_H
+#define WEIGHTS_H
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+#include "configuration.h"
+
+#include "TTree.h"
+#include "TList.h"
+#include "TParameter.h"
+
+namespace sys::trees
+{
+    /**
+     * @enum WeightFormat
+     * @brief The storage format of the universe weights in the output TTrees.
+     * @details The "double" format stores the weights as-is. The "float"
+     * format halves the size of the weight branches and is lossless for the
+     * multisim/multisigma weights, which are stored as floats in the CAF
+     * files. The "int16" format quarters the size of the weight branches by
+     * storing round((w - 1) / q) as a 16-bit integer, where q is the
+     * quantum. The quantum is recorded in the UserInfo of the TTree as a
+     * TParameter<double> named "weight_quantum", so the weights are
+     * recovered as w = 1 + q * stored.
+     */
+    enum class WeightFormat { Double, Float, Int16 };
+
+    /**
+     * @brief Read the weight storage format from the configuration.
+     * @details The format is set by the optional "output.weight_format" field
+     * and defaults to "double".
+     * @param config The configuration table.
+     * @return The weight storage format.
+     * @throw sys::cfg::ConfigurationError if the format is not one of
+     * "double", "float", or "int16".
+     */
+    inline WeightFormat get_weight_format(sys::cfg::ConfigurationTable & config)
+    {
+        std::string format(config.has_field("output.weight_format") ? config.get_string_field("output.weight_format") : "double");
+        if(format == "double")
+            return WeightFormat::Double;
+        else if(format == "float")
+            return WeightFormat::Float;
+        else if(format == "int16")
+            return WeightFormat::Int16;
+        throw sys::cfg::ConfigurationError("Field output.weight_format must be one of 'double', 'float', or 'int16' (found '" + format + "').");
+    }
+
+    /**
+     * @class WeightBranch
+     * @brief A fixed-size array branch of universe weights.
+     * @details This class manages a single array branch of universe weights
+     * in one of the systematic TTrees. The width of the array is either
+     * configured or not known until the first candidates are matched (it is
+     * the number of universes of the parameter in the CAF files), so the
+     * branch is created on demand by @ref create(). The branch buffer is
+     * allocated once and each entry is bulk-copied into it. An entry without
+     * universes receives unit weights; an entry with any other number of
+     * universes than the width is an error, as it cannot be stored without
+     * losing weights. The entries without universes and the weights that
+     * saturate the "int16" format are counted so that they can be reported.
+     */
+    class WeightBranch
+    {
+    public:
+        /**
+         * @brief Constructor for the WeightBranch class.
+         * @param tree The TTree to which the branch belongs.
+         * @param name The name of the branch.
+         * @param format The storage format of the weights.
+         * @param quantum The quantum of the "int16" format.
+         */
+        WeightBranch(TTree * tree, const std::string & name, WeightFormat format, double quantum)
+            : tree(tree), name(name), format(format), quantum(quantum), width(0), created(false), empty(0), saturated(0) {}
+
+        /**
+         * @brief Get the name of the branch.
+         * @return the name of the branch.
+         */
+        const std::string & get_name() const { return name; }
+
+        /**
+         * @brief Get the number of entries stored without universes.
+         * @return the number of entries stored with unit weights.
+         */
+        size_t get_empty() const { return empty; }
+
+        /**
+         * @brief Get the number of weights saturated by the "int16" format.
+         * @return the number of weights with |w - 1| beyond 32767 quanta.
+         */
+        size_t get_saturated() const { return saturated; }
+
+        /**
+         * @brief Check if the branch has been created.
+         * @return true if the branch has been created.
+         */
+        bool is_created() const { return created; }
+
+        /**
+         * @brief Create the branch with the specified width.
+         * @details This function allocates the branch buffer and creates the
+         * branch in the TTree with a leaf list of the form "name[width]/T".
+         * @param w The number of universes (array width).
+         * @return void
+         */
+        void create(size_t w)
+        {
+            width = std::max<size_t>(w, 1);
+            std::string leaf(name + "[" + std::to_string(width) + "]");
+            if(format == WeightFormat::Double)
+            {
+                dbuffer.assign(width, 1.0);
+                tree->Branch(name.c_str(), dbuffer.data(), (leaf + "/D").c_str());
+            }
+            else if(format == WeightFormat::Float)
+            {
+                fbuffer.assign(width, 1.0f);
+                tree->Branch(name.c_str(), fbuffer.data(), (leaf + "/F").c_str());
+            }
+            else
+            {
+                qbuffer.assign(width, 0);
+                tree->Branch(name.c_str(), qbuffer.data(), (leaf + "/S").c_str());
+                if(tree->GetUserInfo()->FindObject("weight_quantum") == nullptr)
+                    tree->GetUserInfo()->Add(new TParameter<double>("weight_quantum", quantum));
+            }
+            created = true;
+        }
+
+        /**
+         * @brief Set the weights of the current entry.
+         * @details This function copies the weights into the branch buffer,
+         * converting them to the storage format. No input weights (a
+         * neutrino without universes for the parameter) are stored as unit
+         * weights.
+         * @tparam T The type of the input weights.
+         * @param src The input weights.
+         * @param n The number of input weights.
+         * @return void
+         * @throw sys::cfg::ConfigurationError if the number of input weights
+         * is neither zero nor the width of the branch.
+         */
+        template<typename T>
+        void set(const T * src, size_t n)
+        {
+            if(n != width && n != 0)
+                throw sys::cfg::ConfigurationError("Branch " + name + " expects " + std::to_string(width) + " universes but found " + std::to_string(n) + ". Set the \"nuniverses\" field of the systematic to the full number of universes.");
+            size_t m(n);
+            empty += n == 0;
+            if(format == WeightFormat::Double)
+            {
+                std::copy(src, src + m, dbuffer.begin());
+                std::fill(dbuffer.begin() + m, dbuffer.end(), 1.0);
+            }
+            else if(format == WeightFormat::Float)
+            {
+                std::copy(src, src + m, fbuffer.begin());
+                std::fill(fbuffer.begin() + m, fbuffer.end(), 1.0f);
+            }
+            else
+            {
+                const double inverse(1.0 / quantum);
+                for(size_t i(0); i < m; ++i)
+                {
+                    double q = std::round((src[i] - 1.0) * inverse);
+                    saturated += std::abs(q) > 32767.0;
+                    qbuffer[i] = static_cast<Short_t>(std::clamp(q, -32767.0, 32767.0));
+                }
+                std::fill(qbuffer.begin() + m, qbuffer.end(), 0);
+            }
+        }
+
+    private:
+        TTree * tree;
+        std::string name;
+        WeightFormat format;
+        double quantum;
+        size_t width;
+        bool created;
+        size_t empty;
+        size_t saturated;
+        std::vector<double> dbuffer;
+        std::vector<float> fbuffer;
+        std::vector<Short_t> qbuffer;
+    };
+} // namespace sys::trees
+#endif // WEIGHTS_H
@@ -45,9 +45,10 @@ namespace sys::cfg
     }
 
     // Check that the requested field is present in the configuration file.
+    // The field may be a dotted path (e.g. "input.threads").
     bool ConfigurationTable::has_field(const std::string & field)
     {
-        return config.contains(field);
+        return static_cast<bool>(config.at_path(field));
     }
 
     // Retrieve the requested string field from the configuration table.
@@ -78,6 +79,16 @@ namespace sys::cfg
         return *value;
     }
 
+    // Retrieve the requested integer field from the configuration table and
+    // check it against the minimum.
+    int64_t ConfigurationTable::get_int_field(const std::string & field, int64_t minimum)
+    {
+        int64_t value(get_int_field(field));
+        if(value < minimum)
+            throw ConfigurationError("Field " + field + " must be at least " + std::to_string(minimum) + " (found " + std::to_string(value) + ").");
+        return value;
+    }
+
     // Retrieve the requested double field from the configuration table.
     double ConfigurationTable::get_double_field(const std::string & field)
     {
@@ -87,6 +98,15 @@ namespace sys::cfg
         return *value;
     }
 
+    // Retrieve the requested boolean field from the configuration table.
+    bool ConfigurationTable::get_bool_field(const std::string & field)
+    {
+        std::optional<bool> value(config.at_path(field).value<bool>());
+        if(!value)
+            throw ConfigurationError("Field " + field + " (bool) not found in the configuration file.");
+        return *value;
+    }
+
     // Retrieve the requested vector of doubles from the configuration table.
     std::vector<double> ConfigurationTable::get_double_vector(const std::string & field)
     {
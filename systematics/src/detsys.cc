@@ -12,51 +12,226 @@
 #include <map>
 #include <vector>
 #include <random>
+#include <iostream>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <memory>
 
 #include "detsys.h"
 #include "configuration.h"
+#include "random.h"
+#include "timing.h"
 #include "utilities.h"
 
 #include "TH1D.h"
 #include "TH2D.h"
 #include "TSpline.h"
 #include "TFile.h"
+#include "TParameter.h"
+#include "TROOT.h"
+#include "TTree.h"
+
+// Read the values of the specified branches from all entries of a TTree. All
+// other branches of the TTree are disabled, so only the baskets of the
+// requested branches are read from the file.
+static std::vector<std::vector<double>> read_columns(TTree * t, const std::vector<std::string> & branches)
+{
+    std::vector<std::vector<double>> columns(branches.size());
+    std::vector<double> values(branches.size(), 0);
+    t->SetBranchStatus("*", 0);
+    for(size_t i(0); i < branches.size(); ++i)
+    {
+        t->SetBranchStatus(branches[i].c_str(), 1);
+        t->SetBranchAddress(branches[i].c_str(), &values[i]);
+        columns[i].reserve(t->GetEntries());
+    }
+    for(Long64_t n(0); n < t->GetEntries(); ++n)
+    {
+        t->GetEntry(n);
+        for(size_t i(0); i < branches.size(); ++i)
+            columns[i].push_back(values[i]);
+    }
+    t->ResetBranchAddresses();
+    t->SetBranchStatus("*", 1);
+    return columns;
+}
+
+// Check whether a set of bin edges is uniformly spaced (to within rounding).
+static bool is_uniform(const std::vector<double> & edges)
+{
+    size_t nbins(edges.size() - 1);
+    double width((edges.back() - edges.front()) / nbins);
+    for(size_t i(1); i < nbins; ++i)
+    {
+        if(std::abs(edges[i] - (edges.front() + i * width)) > 1e-9 * std::abs(width))
+            return false;
+    }
+    return true;
+}
+
+// Create a TH1D with the specified bin edges. Uniform binnings use the fixed
+// width constructor so that the histograms are identical to those of a
+// (nbins, min, max) binning. The histogram is not attached to the current
+// directory, as calculators of different variables share histogram names.
+static TH1D * make_histogram(const std::string & name, const std::vector<double> & edges, bool uniform)
+{
+    TH1D * h = uniform ? new TH1D(name.c_str(), name.c_str(), edges.size() - 1, edges.front(), edges.back())
+                       : new TH1D(name.c_str(), name.c_str(), edges.size() - 1, edges.data());
+    h->SetDirectory(nullptr);
+    return h;
+}
+
+// Create a TH2D with the specified bin edges along X and a uniform binning
+// along Y.
+static TH2D * make_histogram(const std::string & name, const std::vector<double> & edges, bool uniform, int ny, double ymin, double ymax)
+{
+    TH2D * h = uniform ? new TH2D(name.c_str(), name.c_str(), edges.size() - 1, edges.front(), edges.back(), ny, ymin, ymax)
+                       : new TH2D(name.c_str(), name.c_str(), edges.size() - 1, edges.data(), ny, ymin, ymax);
+    h->SetDirectory(nullptr);
+    return h;
+}
+
+// Retrieve the bin edges of a variable from the configuration table. The
+// binning is given by "variations.binning.<variable>.edges" (variable width)
+// or "variations.binning.<variable>.bins" (an (nbins, min, max) triplet). The
+// "variations.bins" triplet is used for the "variations.variable" variable if
+// neither is present.
+std::vector<double> sys::detsys::DetsysCalculator::get_binning(sys::cfg::ConfigurationTable & table, const std::string & variable)
+{
+    std::string prefix("variations.binning." + variable);
+    std::vector<double> edges;
+    if(table.has_field(prefix + ".edges"))
+        edges = table.get_double_vector(prefix + ".edges");
+    else
+    {
+        std::string field(prefix + ".bins");
+        if(!table.has_field(field) && table.has_field("variations.variable") && table.get_string_field("variations.variable") == variable)
+            field = "variations.bins";
+        std::vector<double> bins = table.get_double_vector(field);
+        if(bins.size() != 3 || bins[0] < 1)
+            throw sys::cfg::ConfigurationError("Field " + field + " must be an (nbins, min, max) triplet.");
+        for(int i(0); i <= static_cast<int>(bins[0]); ++i)
+            edges.push_back(bins[1] + i * (bins[2] - bins[1]) / static_cast<int>(bins[0]));
+    }
+    if(edges.size() < 2 || !std::is_sorted(edges.begin(), edges.end()) || std::adjacent_find(edges.begin(), edges.end()) != edges.end())
+        throw sys::cfg::ConfigurationError("The bin edges of variable " + variable + " must be strictly increasing.");
+    return edges;
+}
+
+// Retrieve the seed of the universes from the configuration table. The seed
+// is set by the optional "variations.seed" field; if absent, a seed is drawn
+// at random and printed (and recorded in the output) so that the result can
+// be reproduced.
+uint64_t sys::detsys::DetsysCalculator::get_seed(sys::cfg::ConfigurationTable & table)
+{
+    if(table.has_field("variations.seed"))
+        return static_cast<uint64_t>(table.get_int_field("variations.seed"));
+    std::random_device rd;
+    uint64_t seed((uint64_t(rd()) << 32) | rd());
+    std::cout << "No variations.seed configured; using seed " << static_cast<int64_t>(seed) << " for the detector systematic universes." << std::endl;
+    return seed;
+}
+
+// Read the configured branches of each variation. A "variation" is a single
+// sample that implements some change w.r.t. the nominal sample in the detector
+// model. Only the configured branches are read from each variation TTree. The
+// variations are independent, so they are read in parallel (each worker
+// opening its own handle on the input file) when the optional "input.threads"
+// field is greater than one.
+std::vector<std::vector<std::vector<double>>> sys::detsys::DetsysCalculator::read_variations(sys::cfg::ConfigurationTable & table, TFile * input, const std::vector<std::string> & branches)
+{
+    sys::timing::ScopedTimer timer("detsys.read_variations");
+    std::vector<std::string> variations = table.get_string_vector("variations.keys");
+    std::vector<std::vector<std::vector<double>>> columns(variations.size());
+    auto tree_name = [&](const std::string & variation) { return table.get_string_field("variations.origin") + variation + '/' + table.get_string_field("variations.tree"); };
+    size_t nthreads(table.has_field("input.threads") ? table.get_int_field("input.threads", 1) : 1);
+    nthreads = std::min(nthreads, variations.size());
+    if(nthreads <= 1)
+    {
+        for(size_t v(0); v < variations.size(); ++v)
+            columns[v] = read_columns(input->Get<TTree>(tree_name(variations[v]).c_str()), branches);
+    }
+    else
+    {
+        ROOT::EnableThreadSafety();
+        std::vector<std::string> names;
+        for(const std::string & variation : variations)
+            names.push_back(tree_name(variation));
+        std::string path(input->GetName());
+        std::atomic<size_t> next(0);
+        auto work = [&]()
+        {
+            for(size_t v(next++); v < variations.size(); v = next++)
+            {
+                std::unique_ptr<TFile> f(TFile::Open(path.c_str(), "READ"));
+                columns[v] = read_columns(f->Get<TTree>(names[v].c_str()), branches);
+            }
+        };
+        std::vector<std::thread> workers;
+        for(size_t t(0); t < nthreads; ++t)
+            workers.emplace_back(work);
+        for(std::thread & w : workers)
+            w.join();
+    }
+    uint64_t nentries(0);
+    for(const std::vector<std::vector<double>> & c : columns)
+        nentries += c.empty() ? 0 : c[0].size();
+    sys::timing::stats().add_count("detsys.variation_entries", nentries);
+    return columns;
+}
+
+// Read the values of a single variable for each variation.
+static std::vector<std::vector<double>> read_variable(sys::cfg::ConfigurationTable & table, TFile * input, const std::string & variable)
+{
+    std::vector<std::vector<double>> values;
+    for(std::vector<std::vector<double>> & c : sys::detsys::DetsysCalculator::read_variations(table, input, {variable}))
+        values.push_back(std::move(c[0]));
+    return values;
+}
 
 // Constructor for the DetsysCalculator class that initializes the class using
-// the configuration table, the output file, and the input file. 
+// the configuration table, the output file, and the input file. The binning
+// variable is "variations.variable".
 sys::detsys::DetsysCalculator::DetsysCalculator(sys::cfg::ConfigurationTable & table, TFile * output, TFile * input)
+    : DetsysCalculator(table, output, table.get_string_field("variations.variable"),
+                       get_binning(table, table.get_string_field("variations.variable")),
+                       read_variable(table, input, table.get_string_field("variations.variable")), "", get_seed(table))
+    {}
+
+// Constructor for the DetsysCalculator class that initializes the class for a
+// single binning variable using values of the variable that have already been
+// read from each variation.
+sys::detsys::DetsysCalculator::DetsysCalculator(sys::cfg::ConfigurationTable & table, TFile * output, const std::string & variable, const std::vector<double> & edges, const std::vector<std::vector<double>> & values, const std::string & subdirectory, uint64_t seed)
+    : initialized(true), variable(variable), nominal_count(0), seed(seed), edges(edges), uniform(is_uniform(edges))
 {
-    // Roll random z-scores to create a set of universes for later.
-    std::random_device rd;
-    std::mt19937 gen(rd());
-    std::normal_distribution<double> dist(0, 1);
-    nuniverses = table.get_int_field("variations.nuniverses");
-    for(size_t n(0); n < nuniverses; ++n)
-        random_zscores.push_back(dist(gen));
+    sys::timing::ScopedTimer timer("detsys.build_splines");
+
+    // Roll random z-scores to create a set of universes for later. The
+    // z-score of universe k is a pure function of (seed, k) drawn from a
+    // counter-based generator, so any job (or calculator) configured with the
+    // same seed produces the same universes.
+    nuniverses = table.get_int_field("variations.nuniverses", 1);
+    random_zscores.resize(nuniverses);
+    sys::random::fill_normals(seed, 0, nuniverses, random_zscores.data());
 
     // Create the output directories to store the histograms and splines.
     // Also, load a few configuration details.
-    histogram_directory = create_directory(output, table.get_string_field("variations.histogram_destination"));
-    result_directory = create_directory(output, table.get_string_field("variations.result_destination"));
+    histogram_directory = create_directory(output, table.get_string_field("variations.histogram_destination") + subdirectory);
+    result_directory = create_directory(output, table.get_string_field("variations.result_destination") + subdirectory);
     variations = table.get_string_vector("variations.keys");
-    variable = table.get_string_field("variations.variable");
-
-    // Loop over the variations and create the histograms. A "variation" is a
-    // single sample that implements some change w.r.t. the nominal sample in
-    // the detector model.
-    for(std::string variation : variations)
-    {
-        std::string name = table.get_string_field("variations.origin") + variation + '/' + table.get_string_field("variations.tree");
-        TTree * t = input->Get<TTree>(name.c_str());
-        double value;
-        t->SetBranchAddress(variable.c_str(), &value);
-        std::vector<double> bins = table.get_double_vector("variations.bins");
-        histograms[variation] = new TH1D(variation.c_str(), variation.c_str(), bins[0], bins[1], bins[2]);
-        for(int i(0); i < t->GetEntries(); ++i)
-        {
-            t->GetEntry(i);
-            histograms[variation]->Fill(value);
-        }
+
+    // Fill the histogram of the binning variable for each variation. These
+    // histograms are used to construct the splines.
+    for(size_t v(0); v < variations.size(); ++v)
+    {
+        TH1D * h = make_histogram(variations[v], edges, uniform);
+        for(double value : values[v])
+            h->Fill(value);
+        histograms[variations[v]] = h;
     }
 
     // Loop over the detector systematics and create the splines. A single
@@ -78,14 +253,14 @@ sys::detsys::DetsysCalculator::DetsysCalculator(sys::cfg::ConfigurationTable & t
         // deviations the systematic parameter is from the nominal value).
         std::string name = t.get_string_field("name");
         zscores.insert(std::make_pair(name, t.get_double_vector("zscores")));
-        hdummies.insert(std::make_pair(name, new TH1D("hdummy", "hdummy", histograms[points[0]]->GetNbinsX(), histograms[points[0]]->GetXaxis()->GetXmin(), histograms[points[0]]->GetXaxis()->GetXmax())));
+        hdummies.insert(std::make_pair(name, make_histogram("hdummy", edges, uniform)));
 
         // This block creates a TH2D that will be used to store the input for
         // the spline construction. The TH2D is filled with the ratio of the
         // variations to the nominal sample (across the range of the variable)
         // for each of the spline points. Each spline point is adjusted by the
         // scale factor configured in the "detsys" block.
-        TH2D * h = new TH2D("tmp", "tmp", hdummies[name]->GetNbinsX(), hdummies[name]->GetXaxis()->GetXmin(), hdummies[name]->GetXaxis()->GetXmax(), points.size(), zscores[name][0], zscores[name].back());
+        TH2D * h = make_histogram("tmp", edges, uniform, points.size(), zscores[name][0], zscores[name].back());
         for(size_t i(0); i < points.size(); ++i)
         {
             hdummies[name]->Divide(histograms[points[i]], histograms[t.get_string_field("ordinate")]);
@@ -112,10 +287,95 @@ sys::detsys::DetsysCalculator::DetsysCalculator(sys::cfg::ConfigurationTable & t
             splines[name].push_back(new TSpline3("spline", x.data(), y.data(), x.size()));
         }
 
+        // Flatten the spline coefficients into a table for fast evaluation.
+        // The coefficients of the last knot are not needed, as TSpline3
+        // evaluates values beyond the last knot using the last segment.
+        SplineTable flat;
+        flat.xmin = edges.front();
+        flat.xmax = edges.back();
+        flat.nbins = edges.size() - 1;
+        flat.inverse_width = flat.nbins / (flat.xmax - flat.xmin);
+        flat.uniform = uniform;
+        flat.edges = edges;
+        flat.nsegments = points.size() > 1 ? points.size() - 1 : 1;
+        flat.knots = zscores[name];
+        flat.counts.assign(flat.nbins + 2, 0);
+        for(TSpline3 * spline : splines[name])
+        {
+            for(size_t k(0); k < flat.nsegments; ++k)
+            {
+                double x, y, b, c, d;
+                spline->GetCoeff(k, x, y, b, c, d);
+                flat.coefficients.insert(flat.coefficients.end(), {y, b, c, d});
+            }
+        }
+
+        // Tabulate the weights at the configured z-scores for each bin. These
+        // are the per-candidate weights that are written to the output TTree.
+        flat.knot_weights.resize(flat.nbins * flat.knots.size());
+        for(int j(0); j < flat.nbins; ++j)
+            flat.eval(j, flat.knots.data(), flat.knots.size(), &flat.knot_weights[j * flat.knots.size()]);
+        handles[name] = tables.size();
+        tables.push_back(std::move(flat));
+        names.push_back(name);
+
         // Create the TH1D and TH2D that will be used to store the results of
         // the detector systematic universes.
         detsys_results1D[name] = new TH1D(name.c_str(), name.c_str(), 1000, -0.25, 0.25);
-        detsys_results2D[name] = new TH2D(name.c_str(), name.c_str(), hdummies[name]->GetNbinsX(), hdummies[name]->GetXaxis()->GetXmin(), hdummies[name]->GetXaxis()->GetXmax(), nuniverses, 0, nuniverses);
+        detsys_results1D[name]->SetDirectory(nullptr);
+        detsys_results2D[name] = make_histogram(name, edges, uniform, nuniverses, 0, nuniverses);
+    }
+}
+
+// Find the bin of the variable in the flattened spline table. Non-finite
+// values are sorted by their bit pattern before any comparison: the project
+// is built with -Ofast, which assumes finite math and may remove comparisons
+// (or std::isnan) that would otherwise catch a NaN. A NaN or +inf belongs to
+// the overflow bin (as TH1::Fill does) and -inf to the underflow bin.
+int sys::detsys::DetsysCalculator::SplineTable::find_bin(double value) const
+{
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    if((bits & 0x7ff0000000000000ULL) == 0x7ff0000000000000ULL)
+        return bits == 0xfff0000000000000ULL ? -1 : nbins;
+    if(value < xmin)
+        return -1;
+    if(!(value <= xmax))
+        return nbins;
+    if(!uniform)
+        return std::min<int>(std::upper_bound(edges.begin(), edges.end(), value) - edges.begin() - 1, nbins - 1);
+    int bin = static_cast<int>((value - xmin) * inverse_width);
+    return bin < nbins ? bin : nbins - 1;
+}
+
+// Evaluate the spline of a bin in the flattened spline table. This mirrors
+// the evaluation in TSpline3::Eval: values below the first knot (above the
+// last knot) are extrapolated using the first (last) segment.
+double sys::detsys::DetsysCalculator::SplineTable::eval(int bin, double zscore) const
+{
+    size_t k(0);
+    while(k + 1 < nsegments && zscore >= knots[k + 1])
+        ++k;
+    const double * c = &coefficients[(bin * nsegments + k) * 4];
+    double dx = zscore - knots[k];
+    return c[0] + dx * (c[1] + dx * (c[2] + dx * c[3]));
+}
+
+// Evaluate the spline of a bin in the flattened spline table for a batch of
+// z-scores. The knots are sorted, so the segment is the number of interior
+// knots at or below the z-score, matching the search in the scalar version.
+void sys::detsys::DetsysCalculator::SplineTable::eval(int bin, const double * zscores, size_t n, double * out) const
+{
+    const double * c = &coefficients[bin * nsegments * 4];
+    const double * x = knots.data();
+    for(size_t i(0); i < n; ++i)
+    {
+        size_t k(0);
+        for(size_t j(1); j < nsegments; ++j)
+            k += (zscores[i] >= x[j]);
+        const double * ck = c + 4 * k;
+        double dx = zscores[i] - x[k];
+        out[i] = ck[0] + dx * (ck[1] + dx * (ck[2] + dx * ck[3]));
     }
 }
 
@@ -149,11 +409,24 @@ void sys::detsys::DetsysCalculator::increment_nominal_count(double value)
 }
 
 // Method to get the zscores for a given detector systematic parameter.
-std::vector<double> sys::detsys::DetsysCalculator::get_zscores(std::string name)
+const std::vector<double> & sys::detsys::DetsysCalculator::get_zscores(const std::string & name)
 {
     return zscores[name];
 }
 
+// Method to get the zscores for a given detector systematic parameter by
+// handle.
+const std::vector<double> & sys::detsys::DetsysCalculator::get_zscores(size_t handle)
+{
+    return tables[handle].knots;
+}
+
+// Method to resolve the handle of a detector systematic parameter.
+size_t sys::detsys::DetsysCalculator::get_handle(const std::string & name) const
+{
+    return handles.at(name);
+}
+
 // Write the histogram of each configured variation and the splines for each
 // detector systematic parameter to the output file.
 void sys::detsys::DetsysCalculator::write()
@@ -172,28 +445,55 @@ void sys::detsys::DetsysCalculator::write()
 }
 
 // Write the result histograms for each detector systematic parameter to the
-// output file.
+// output file. The per-universe results are built from the per-bin candidate
+// counts: each universe weight depends only on the bin of the variable, so the
+// content of a (bin, universe) cell is the count times the weight and the
+// error is the square root of the count times the weight.
 void sys::detsys::DetsysCalculator::write_results()
 {
+    sys::timing::ScopedTimer timer("detsys.write_results");
     result_directory->cd();
-    for(auto & [key, value] : detsys_results2D)
+    for(size_t handle(0); handle < tables.size(); ++handle)
     {
-        std::string name = key + "_2D";
-        result_directory->WriteObject(value, name.c_str());
-        for(int i(0); i < value->GetNbinsY(); ++i)
+        const SplineTable & t = tables[handle];
+        TH2D * h2 = detsys_results2D[names[handle]];
+        std::vector<double> sums(nuniverses, 0);
+        std::vector<double> row(nuniverses, 1.0);
+        double entries(0);
+        for(int b(-1); b <= t.nbins; ++b)
         {
-            double sum(0);
-            for(int j(0); j < value->GetNbinsX(); ++j)
-                sum += value->GetBinContent(j+1, i+1);
-            detsys_results1D[key]->Fill((sum - nominal_count) / nominal_count);
+            double count(t.counts[b + 1]);
+            if(count == 0)
+                continue;
+            entries += count;
+            bool in_range(b >= 0 && b < t.nbins);
+            if(in_range)
+                t.eval(b, random_zscores.data(), nuniverses, row.data());
+            else
+                std::fill(row.begin(), row.end(), 1.0);
+            for(size_t i(0); i < nuniverses; ++i)
+            {
+                h2->SetBinContent(b + 1, i + 1, count * row[i]);
+                h2->SetBinError(b + 1, i + 1, std::sqrt(count) * std::abs(row[i]));
+                if(in_range)
+                    sums[i] += count * row[i];
+            }
         }
+        h2->ResetStats();
+        h2->SetEntries(entries * nuniverses);
+
+        std::string name = names[handle] + "_2D";
+        result_directory->WriteObject(h2, name.c_str());
+        for(size_t i(0); i < nuniverses; ++i)
+            detsys_results1D[names[handle]]->Fill((sums[i] - nominal_count) / nominal_count);
     }
     for(auto & [key, value] : detsys_results1D)
     {
         std::string name = key + "_1D";
         result_directory->WriteObject(value, name.c_str());
     }
-    
+    TParameter<Long64_t> p("seed", static_cast<Long64_t>(seed));
+    result_directory->WriteObject(&p, "seed");
 }
 
 // Accessor method for the histograms.
@@ -204,21 +504,173 @@ TH1D * sys::detsys::DetsysCalculator::operator[](std::string key)
 
 // Method to get the weight for a given detector systematic parameter, value
 // of the binning variable, and z-score.
-double sys::detsys::DetsysCalculator::get_weight(std::string name, double value, double zscore)
+double sys::detsys::DetsysCalculator::get_weight(const std::string & name, double value, double zscore)
+{
+    return get_weight(get_handle(name), value, zscore);
+}
+
+// Method to get the weight for a given detector systematic parameter (by
+// handle), value of the binning variable, and z-score. This mirrors the
+// evaluation in TSpline3::Eval, but uses the flattened coefficient table.
+double sys::detsys::DetsysCalculator::get_weight(size_t handle, double value, double zscore) const
 {
-    if(value < hdummies[name]->GetXaxis()->GetXmin() || value > hdummies[name]->GetXaxis()->GetXmax())
+    const SplineTable & t = tables[handle];
+    int bin = t.find_bin(value);
+    if(bin < 0 || bin >= t.nbins)
         return 1;
+    return t.eval(bin, zscore);
+}
+
+// Method to get the weights for a given detector systematic parameter (by
+// handle), value of the binning variable, and batch of z-scores.
+void sys::detsys::DetsysCalculator::get_weights(size_t handle, double value, const double * zscores, size_t n, double * out) const
+{
+    const SplineTable & t = tables[handle];
+    int bin = t.find_bin(value);
+    if(bin < 0 || bin >= t.nbins)
+        std::fill(out, out + n, 1.0);
     else
-    {
-        int bin = hdummies[name]->FindBin(value);
-        return splines[name][bin-1]->Eval(zscore);
-    }
+        t.eval(bin, zscores, n, out);
+}
+
+// Method to get the weights for a given detector systematic parameter (by
+// handle) and value of the binning variable at the configured z-scores.
+void sys::detsys::DetsysCalculator::get_weights(size_t handle, double value, double * out) const
+{
+    const SplineTable & t = tables[handle];
+    size_t n(t.knots.size());
+    int bin = t.find_bin(value);
+    if(bin < 0 || bin >= t.nbins)
+        std::fill(out, out + n, 1.0);
+    else
+        std::copy(&t.knot_weights[bin * n], &t.knot_weights[bin * n] + n, out);
 }
 
 // Method to add a value to the detector systematic parameter histogram
 // for all pre-roll z-scores (universes).
-void sys::detsys::DetsysCalculator::add_value(std::string name, double value)
+void sys::detsys::DetsysCalculator::add_value(const std::string & name, double value)
+{
+    add_value(get_handle(name), value);
+}
+
+// Method to add a value to the detector systematic parameter histogram
+// (by handle) for all pre-roll z-scores (universes). The universe weights
+// are applied when the results are written, so only the bin count is
+// recorded here.
+void sys::detsys::DetsysCalculator::add_value(size_t handle, double value)
+{
+    SplineTable & t = tables[handle];
+    t.counts[t.find_bin(value) + 1] += 1;
+}
+
+// Constructor for the DetsysRegistry class. The binning variables and any
+// extra variables are read from the variations in a single pass, and a
+// calculator is created for each binning variable. All calculators share the
+// same seed, and therefore the same universes.
+sys::detsys::DetsysRegistry::DetsysRegistry(sys::cfg::ConfigurationTable & table, TFile * output, TFile * input)
+{
+    if(table.has_field("variations.variables"))
+        variables = table.get_string_vector("variations.variables");
+    else
+        variables = {table.get_string_field("variations.variable")};
+    if(variables.empty())
+        throw sys::cfg::ConfigurationError("Field variations.variables must list at least one variable.");
+
+    std::vector<std::string> branches(variables);
+    std::vector<std::vector<double>> binnings;
+    for(const std::string & v : variables)
+        binnings.push_back(DetsysCalculator::get_binning(table, v));
+    if(table.has_field("variations.extra_variables"))
+    {
+        std::vector<std::string> extra = table.get_string_vector("variations.extra_variables");
+        std::vector<double> extra_bins = table.get_double_vector("variations.extra_bins");
+        if(extra_bins.size() != 3 * extra.size())
+            throw sys::cfg::ConfigurationError("Field variations.extra_bins must contain one (nbins, min, max) triplet per entry of variations.extra_variables.");
+        for(size_t i(0); i < extra.size(); ++i)
+        {
+            branches.push_back(extra[i]);
+            std::vector<double> edges;
+            for(int j(0); j <= static_cast<int>(extra_bins[3 * i]); ++j)
+                edges.push_back(extra_bins[3 * i + 1] + j * (extra_bins[3 * i + 2] - extra_bins[3 * i + 1]) / static_cast<int>(extra_bins[3 * i]));
+            binnings.push_back(edges);
+        }
+    }
+
+    uint64_t seed(DetsysCalculator::get_seed(table));
+    std::vector<std::string> keys = table.get_string_vector("variations.keys");
+    std::vector<std::vector<std::vector<double>>> columns(DetsysCalculator::read_variations(table, input, branches));
+    for(size_t b(0); b < variables.size(); ++b)
+    {
+        std::vector<std::vector<double>> values;
+        for(std::vector<std::vector<double>> & c : columns)
+            values.push_back(std::move(c[b]));
+        std::string subdirectory(variables.size() > 1 ? variables[b] + "/" : "");
+        calculators.emplace_back(table, output, variables[b], binnings[b], values, subdirectory, seed);
+    }
+
+    histogram_directory = create_directory(output, table.get_string_field("variations.histogram_destination"));
+    for(size_t b(variables.size()); b < branches.size(); ++b)
+    {
+        for(size_t v(0); v < keys.size(); ++v)
+        {
+            std::string hname(keys[v] + "_" + branches[b]);
+            TH1D * h = make_histogram(hname, binnings[b], true);
+            for(double value : columns[v][b])
+                h->Fill(value);
+            extra_histograms[hname] = h;
+        }
+    }
+}
+
+// Default constructor for the DetsysRegistry class.
+sys::detsys::DetsysRegistry::DetsysRegistry()
+    : histogram_directory(nullptr)
+    {}
+
+// Accessor method for the number of calculators.
+size_t sys::detsys::DetsysRegistry::size() const
+{
+    return calculators.size();
+}
+
+// Accessor method for the calculators.
+sys::detsys::DetsysCalculator & sys::detsys::DetsysRegistry::operator[](size_t index)
+{
+    return calculators[index];
+}
+
+// Method to get the name of the weight branch of a detector systematic
+// parameter for a given calculator.
+std::string sys::detsys::DetsysRegistry::get_branch_name(size_t index, const std::string & name) const
+{
+    return variables.size() > 1 ? name + "_" + variables[index] : name;
+}
+
+// Increment the nominal count of every calculator by the specified value.
+void sys::detsys::DetsysRegistry::increment_nominal_count(double value)
+{
+    for(DetsysCalculator & c : calculators)
+        c.increment_nominal_count(value);
+}
+
+// Write the variation histograms and splines of every calculator and the
+// histograms of the extra variables to the output file.
+void sys::detsys::DetsysRegistry::write()
+{
+    for(DetsysCalculator & c : calculators)
+        c.write();
+    if(histogram_directory != nullptr)
+    {
+        histogram_directory->cd();
+        for(auto & [key, value] : extra_histograms)
+            histogram_directory->WriteObject(value, key.c_str());
+    }
+}
+
+// Write the detector systematic results of every calculator to the output
+// file.
+void sys::detsys::DetsysRegistry::write_results()
 {
-    for(size_t i(0); i < nuniverses; ++i)
-        detsys_results2D[name]->Fill(value, i, get_weight(name, value, random_zscores[i]));
+    for(DetsysCalculator & c : calculators)
+        c.write_results();
 }
@@ -18,10 +18,12 @@
 #include "configuration.h"
 #include "trees.h"
 #include "detsys.h"
+#include "timing.h"
 
 #include "TROOT.h"
 #include "TFile.h"
 #include "TDirectory.h"
+#include "TNamed.h"
 
 int main(int argc, char * argv[])
 {
@@ -77,22 +79,27 @@ int main(int argc, char * argv[])
      * analysis framework. The output ROOT file is the file that will contain
      * the TTrees that are produced by this code.
      */
+    sys::timing::Accumulator t_total;
+    t_total.start();
     TFile * input = TFile::Open(config.get_string_field("input.path").c_str(), "READ");
     TFile * output = TFile::Open(config.get_string_field("output.path").c_str(), "RECREATE");
 
     /**
-     * @brief Load the DetsysCalculator, if configured.
-     * @details This block loads the DetsysCalculator if it is configured in
-     * the configuration file. The DetsysCalculator is used to calculate the
+     * @brief Load the DetsysCalculators, if configured.
+     * @details This block loads the DetsysCalculators if they are configured
+     * in the configuration file. A DetsysCalculator is used to calculate the
      * detector systematics weights using a spline interpolation of the ratio
-     * of the nominal and sample histograms.
+     * of the nominal and sample histograms. The registry holds one calculator
+     * for each configured binning variable.
      * @see sys::detsys::DetsysCalculator
+     * @see sys::detsys::DetsysRegistry
      */
-    sys::detsys::DetsysCalculator calc;
+    sys::detsys::DetsysRegistry detsys;
     if(config.has_field("variations"))
     {
-        calc = sys::detsys::DetsysCalculator(config, output, input);
-        calc.write();
+        sys::timing::ScopedTimer timer("detsys.setup");
+        detsys = sys::detsys::DetsysRegistry(config, output, input);
+        detsys.write();
     }
 
     /**
@@ -122,14 +129,43 @@ int main(int argc, char * argv[])
     {
         std::cout << "Processing tree: " << table.get_string_field("origin") << std::endl;
         std::string type(table.get_string_field("action"));
-        if(type == "copy")
-            sys::trees::copy_tree(table, output, input);
-        else if(type == "add_weights")
-            sys::trees::copy_with_weight_systematics(config, table, output, input, calc);
+        sys::timing::ScopedTimer timer("tree." + type);
+        try
+        {
+            if(type == "copy")
+                sys::trees::copy_tree(table, output, input);
+            else if(type == "add_weights")
+                sys::trees::copy_with_weight_systematics(config, table, output, input, detsys);
+        }
+        catch(const std::exception & e)
+        {
+            std::cerr << "Error: processing tree " << table.get_string_field("origin") << " failed: " << e.what() << std::endl;
+            input->Close();
+            output->Close();
+            return 1;
+        }
+    }
+
+    /**
+     * @brief Record the timing summary.
+     * @details This block prints a summary table of the time spent in each
+     * stage and of the counters accumulated during the processing (see
+     * @ref sys::timing::Stats). If the optional "output.timing" field is set,
+     * the summary is also written to the output file as a JSON string (the
+     * title of a TNamed named "timing") so that the performance of jobs can
+     * be compared.
+     */
+    t_total.stop();
+    t_total.commit("total");
+    if(config.has_field("output.timing") && config.get_bool_field("output.timing"))
+    {
+        TNamed timing("timing", sys::timing::stats().to_json().c_str());
+        output->WriteObject(&timing, "timing");
     }
 
     input->Close();
     output->Close();
+    sys::timing::stats().print(std::cout);
 
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,114 @@
+/**
+ * @file test_detsys.cc
+ * @brief Tests of the handling of out-of-range values by the detector
+ * systematics kernels.
+ * @details This file contains a test of the @ref
+ * sys::detsys::DetsysCalculator with a synthetic configuration and
+ * synthetic variations (see bench_detsys.cc). Candidates with a NaN, an
+ * infinite, or a finite out-of-range value must land in the underflow or
+ * overflow, so every weight (single, tabulated, and batched) is one.
+ * The test is built without -ffinite-math-only so that the non-finite
+ * inputs are not optimized away in the test itself, while the calculator is
+ * the library built with the project flags.
+ * @author mueller@fnal.gov
+ */
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include <toml++/toml.h>
+
+#include "configuration.h"
+#include "detsys.h"
+
+#include "TMemFile.h"
+
+/**
+ * @brief The synthetic configuration of the detector systematics.
+ * @details Three variations (nominal, +1 sigma, and -1 sigma) define a single
+ * detector systematic with three spline points.
+ */
+static const char * configuration = R"(
+[variations]
+keys = ['cv', 'p1', 'm1']
+histogram_destination = 'variations/'
+result_destination = 'results/'
+nuniverses = 100
+seed = 20240601
+
+[[detsys]]
+name = 'test'
+ordinate = 'cv'
+points = ['m1', 'cv', 'p1']
+scale = [1.0, 1.0, 1.0]
+zscores = [-1.0, 0.0, 1.0]
+)";
+
+/**
+ * @brief Check the weights of out-of-range values for a binning.
+ * @details The binning spans [0, 3] with the specified number of bins.
+ * @param nbins The number of bins.
+ * @param uniform Whether the bins are of uniform width.
+ * @return the number of failed checks.
+ */
+static int check_out_of_range(size_t nbins, bool uniform)
+{
+    std::vector<double> edges;
+    for(size_t i(0); i <= nbins; ++i)
+    {
+        double x(static_cast<double>(i) / nbins);
+        edges.push_back(3 * (uniform ? x : x * x));
+    }
+
+    std::mt19937_64 rng(20240601);
+    std::vector<std::vector<double>> values(3);
+    const double means[3] = {1.5, 1.55, 1.45};
+    for(size_t k(0); k < values.size(); ++k)
+    {
+        std::normal_distribution<double> normal(means[k], 0.5);
+        for(size_t i(0); i < 10000; ++i)
+            values[k].push_back(normal(rng));
+    }
+    sys::cfg::ConfigurationTable table(toml::parse(configuration));
+    TMemFile output("test_detsys.root", "RECREATE");
+    sys::detsys::DetsysCalculator calc(table, &output, "x", edges, values, "", 20240601);
+    size_t handle(calc.get_handle("test"));
+
+    const std::vector<double> inputs = {std::numeric_limits<double>::quiet_NaN(), -std::numeric_limits<double>::quiet_NaN(),
+                                        std::numeric_limits<double>::infinity(), -std::numeric_limits<double>::infinity(),
+                                        -1.0, 3.5};
+    const std::string names[6] = {"nan", "-nan", "inf", "-inf", "-1.0", "3.5"};
+    std::vector<double> knots(calc.get_zscores(handle).size());
+    std::vector<double> zscores = {-2.0, -0.5, 0.0, 0.5, 2.0};
+    std::vector<double> batch(zscores.size());
+    int failures(0);
+    for(size_t i(0); i < inputs.size(); ++i)
+    {
+        bool ok(calc.get_weight(handle, inputs[i], 0.5) == 1.0);
+        calc.get_weights(handle, inputs[i], knots.data());
+        calc.get_weights(handle, inputs[i], zscores.data(), zscores.size(), batch.data());
+        for(double w : knots)
+            ok = ok && w == 1.0;
+        for(double w : batch)
+            ok = ok && w == 1.0;
+        calc.add_value(handle, inputs[i]);
+        if(!ok)
+        {
+            std::cerr << "FAIL: value " << names[i] << " was assigned to an in-range bin (nbins = " << nbins << ", uniform = " << uniform << ")." << std::endl;
+            ++failures;
+        }
+    }
+    return failures;
+}
+
+int main()
+{
+    int failures(0);
+    failures += check_out_of_range(30, true);
+    failures += check_out_of_range(30, false);
+    if(failures == 0)
+        std::cout << "All out-of-range checks passed." << std::endl;
+    return failures == 0 ? 0 : 1;
+}